@@ -4,6 +4,7 @@
 #define SRCDIR "src/"
 #define OBJDIR "obj/"
 #define BINARY "span.bin"
+#define BENCH_BINARY "bench.bin"
 #define VENDORDIR "vendor/"
 #define VENDOR_INCDIR VENDORDIR"include"
 #define VENDOR_LIBDIR VENDORDIR"lib"
@@ -22,16 +23,17 @@ void compile_objs(const char *src_name)
     nob_cmd_append(&cmd, nob_temp_sprintf(OBJDIR"%s.o", src_name));
 }
 
-void link_objs(size_t n, const char *src_names[n])
+void link_objs(size_t n, const char *src_names[n], const char *binary)
 {
     nob_cmd_append(&cmd, CC);
     for (size_t i = 0; i < n; i++) {
         nob_cmd_append(&cmd, nob_temp_sprintf(OBJDIR"%s.o", src_names[i]));
     }
-    nob_cmd_append(&cmd, "-o", BINARY);
+    nob_cmd_append(&cmd, "-o", binary);
     nob_cmd_append(&cmd, "-L"VENDOR_LIBDIR);
     nob_cmd_append(&cmd, "-l:libraylib.a", "-lm");
     nob_cmd_append(&cmd, "-l:libumka.a");
+    nob_cmd_append(&cmd, "-lpthread", "-ldl");
 }
 
 int main(int argc, char **argv)
@@ -40,16 +42,25 @@ int main(int argc, char **argv)
 
     nob_shift_args(&argc, &argv);
     bool run_bin = false;
+    bool bench = false;
     if (argc > 0) {
         if (!strncmp(argv[0], "run", 3)) {
             run_bin = true;
+        } else if (!strncmp(argv[0], "bench", 5)) {
+            bench = true;
         } else {
             nob_log(NOB_ERROR, "Wrong usage. Will document at some point...");
             return 1;
         }
     }
 
-    const char *src_names[] = { "main", "ffmpeg_linux", "span" };
+    // NOTE: The first one is the entry point, `bench` swaps it out
+    const char *src_names[] = { "main", "ffmpeg_linux", "watch_linux", "headless_linux", "span" };
+    const char *binary = BINARY;
+    if (bench) {
+        src_names[0] = "bench";
+        binary = BENCH_BINARY;
+    }
 
     size_t n = NOB_ARRAY_LEN(src_names);
     for (size_t i = 0; i < n; i++) {
@@ -58,12 +69,12 @@ int main(int argc, char **argv)
         if (!nob_cmd_run_sync(cmd)) return 1;
     }
     cmd.count = 0;
-    link_objs(n, src_names);
+    link_objs(n, src_names, binary);
     if (!nob_cmd_run_sync(cmd)) return 1;
 
-    if (run_bin) {
+    if (run_bin || bench) {
         cmd.count = 0;
-        nob_cmd_append(&cmd, "./"BINARY);
+        nob_cmd_append(&cmd, nob_temp_sprintf("./%s", binary));
         if (!nob_cmd_run_sync(cmd)) return 1;
     }
     return 0;
@@ -0,0 +1,853 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "raylib.h"
+#include "raymath.h"
+#define ARENA_IMPLEMENTATION
+#include "span.h"
+#include "headless.h"
+#define NOB_IMPLEMENTATION
+#include "../nob.h"
+
+// NOTE: Measures how long it takes to get from a script to a built scene. The
+// first compile is what startup pays, the rest are what every reload pays.
+// Nothing here needs a window, so it also runs on machines without a display.
+//
+// `synth` generates a scene instead and plays it frame by frame, like
+// rendering a video does, and prints percentiles of every stage as JSON.
+//
+// `golden` plays the scenes in `BENCH_GOLDEN_MANIFEST` the same way and checks
+// frames of them against stored images, and the times of every stage but the
+// encode against stored baselines. It needs a GL context like `synth` does.
+
+#define BENCH_RUNS 20
+#define BENCH_SYNTH_SCRIPT SP_CACHE_DIR"/synth.um"
+#define BENCH_SYNTH_VIDEO SP_CACHE_DIR"/synth.mov"
+#define BENCH_GOLDEN_DIR "bench/golden"
+#define BENCH_GOLDEN_MANIFEST BENCH_GOLDEN_DIR"/scenes.txt"
+#define BENCH_GOLDEN_RUNS 3
+#define BENCH_GOLDEN_MAX_FRAMES 64
+// NOTE: A pixel differs once any of its channels is off by more than
+// `TOLERANCE`, a frame fails once more than `MAX_DIFF` of its pixels differ.
+// It also fails once the mean luma of any `BLOCK` sized square is off by more
+// than `PERCEPTUAL`, which catches a small shape that moved or changed color.
+#define BENCH_GOLDEN_TOLERANCE 2
+#define BENCH_GOLDEN_MAX_DIFF 0.001
+#define BENCH_GOLDEN_BLOCK 8
+#define BENCH_GOLDEN_PERCEPTUAL 2.0
+// NOTE: How much slower than its baseline a stage may get, in percent. Below
+// `SLACK_MIN_MS` the difference is noise.
+#define BENCH_GOLDEN_SLACK 25.0
+#define BENCH_GOLDEN_SLACK_MIN_MS 0.05
+
+typedef struct {
+    f64 compile_ms, first_ms, run_ms;
+    TaskOptimizer opt;
+} BenchBuild;
+
+typedef enum {
+    BS_Update,
+    // NOTE: The CPU side of drawing a frame, querying the grid and
+    // gathering the rects
+    BS_Cull,
+    BS_Render,
+    BS_Readback,
+    BS_Encode,
+    BS_COUNT,
+} BenchStage;
+
+static const char *bench__stage_names[BS_COUNT] = {
+    [BS_Update] = "update",
+    [BS_Cull] = "cull",
+    [BS_Render] = "render",
+    [BS_Readback] = "readback",
+    [BS_Encode] = "encode",
+};
+
+typedef struct {
+    int rects, moving, curves, points, typst, frames;
+} SynthParams;
+
+static int bench__cmp(const void *a, const void *b)
+{
+    f64 x = *(const f64 *)a, y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+// NOTE: The first run is reported on its own, it pays for whatever is cold
+static void bench__report(const char *name, f64 *ms, int n)
+{
+    qsort(ms + 1, n - 1, sizeof(f64), bench__cmp);
+    printf("%-10s cold %7.3f ms, warm min %7.3f / median %7.3f / max %7.3f ms\n",
+        name, ms[0], ms[1], ms[1 + (n - 1) / 2], ms[n - 1]);
+}
+
+// NOTE: Nearest rank, `ms` has to be sorted
+static f64 bench__percentile(const f64 *ms, int n, f64 p)
+{
+    int rank = (int)ceil(p / 100.0 * n);
+    if (rank < 1) rank = 1;
+    return ms[rank - 1];
+}
+
+static void bench__free_arena(Arena *a)
+{
+    if (a == NULL) return;
+    arena_free(a);
+    free(a);
+}
+
+// NOTE: Builds the whole scene and keeps it around like a reload would, so
+// the next build gets to reuse its objects
+static bool bench__build(const char *filename, BenchBuild *b)
+{
+    Scene *sc = spc_new_scene();
+    sc->prev = ctx.store;
+
+    f64 start = sp_now();
+    if (!spc_umka_init(sc, filename)) return false;
+    f64 compiled = sp_now();
+    if (!spc_run_umka(sc)) return false;
+    f64 first = sp_now();
+    while (!sc->done) {
+        if (!sps_step(sc)) return false;
+    }
+    b->compile_ms = (compiled - start) * 1000.0;
+    b->first_ms = (first - compiled) * 1000.0;
+    b->run_ms = (sp_now() - compiled) * 1000.0;
+    b->opt = sc->opt;
+
+    for (int j = 0; j < ctx.store.typsts.count; j++) {
+        UnloadImage(ctx.store.typsts.items[j].image);
+    }
+    if (ctx.umka != NULL) umkaFree(ctx.umka);
+    bench__free_arena(ctx.scene_arena);
+    // NOTE: Like `spc_swap_scene`, whatever was played lived in the old arena
+    ctx.state = (ObjState){0};
+    ctx.changed = (ChangedSet){0};
+    ctx.bake = (UpdaterBake){0};
+    ctx.grid.capacity = 0;
+    ctx.umka = sc->umka;
+    ctx.scene_arena = sc->arena;
+    ctx.store = sc->store;
+    ctx.orig = sc->orig;
+    ctx.tasks = sc->tasks;
+    ctx.updaters = sc->updaters;
+    ctx.id_counter = sc->id_counter;
+    ctx.handles = sc->handles;
+    free(sc);
+    return true;
+}
+
+// NOTE: A reset only restores the objects that changed, so the playback
+// state has to start out as a copy, like `spc_swap_scene` makes it
+static void bench__playback_init(void)
+{
+    int n = ctx.orig.count;
+    spo_state_reserve(ctx.scene_arena, &ctx.state, n);
+    spc_changed_reserve(ctx.scene_arena, n);
+    memcpy(ctx.state.pos, ctx.orig.pos, n*sizeof(*ctx.state.pos));
+    memcpy(ctx.state.color, ctx.orig.color, n*sizeof(*ctx.state.color));
+    memcpy(ctx.state.enabled, ctx.orig.enabled, n*sizeof(*ctx.state.enabled));
+    ctx.state.count = n;
+}
+
+// NOTE: Playback of the last build. The query and the walk are what drawing
+// a frame does minus the GPU, which isn't there without a window. The query
+// includes building the grid when the seek left it stale. Neither is the
+// default font, which the grid needs to measure text.
+static void bench__playback(int runs)
+{
+    int n = ctx.orig.count;
+    if (ctx.store.texts.count > 0) {
+        printf("%d objects, playback skipped, text can't be measured without a window\n", n);
+        return;
+    }
+    bench__playback_init();
+    f64 duration = 0.0;
+    for (int i = 0; i < ctx.tasks.count; i++) duration += ctx.tasks.items[i].duration;
+
+    enum { PB_Reset, PB_Seek, PB_Query, PB_Walk, PB_COUNT };
+    static const char *names[PB_COUNT] = {
+        [PB_Reset] = "reset",
+        [PB_Seek] = "seek",
+        [PB_Query] = "query",
+        [PB_Walk] = "walk",
+    };
+    f64 *ms[PB_COUNT];
+    for (int k = 0; k < PB_COUNT; k++) {
+        ms[k] = malloc(runs * sizeof(f64));
+        SP_ASSERT(ms[k] != NULL && "Buy MORE RAM lol!!");
+    }
+    RectBatch batch = {0};
+    for (int i = 0; i < runs; i++) {
+        f64 start = sp_now();
+        spc_reset();
+        ms[PB_Reset][i] = (sp_now() - start) * 1000.0;
+
+        start = sp_now();
+        spc_seek(duration * 0.5);
+        ms[PB_Seek][i] = (sp_now() - start) * 1000.0;
+
+        start = sp_now();
+        spg_query(&ctx.grid, spg_view_rect(ctx.cam, ctx.vres));
+        ms[PB_Query][i] = (sp_now() - start) * 1000.0;
+
+        start = sp_now();
+        for (int j = 0; j < ctx.grid.visible.count; j++) {
+            Id id = ctx.grid.visible.items[j];
+            if (ctx.store.kind[id] != OK_RECT) continue;
+            const Rect *r = &ctx.store.rects.items[ctx.store.payload[id]];
+            spr_batch_push(&batch, ctx.state.pos[id], r->size, ctx.state.color[id]);
+        }
+        batch.pending.count = 0;
+        ms[PB_Walk][i] = (sp_now() - start) * 1000.0;
+    }
+
+    // NOTE: What each object costs while playing, the store is only read
+    int bytes = sizeof(*ctx.state.pos) + sizeof(*ctx.state.color) + sizeof(*ctx.state.enabled);
+    printf("%d objects, %d B of playback state each, %d culled\n", n, bytes, ctx.grid.culled);
+    for (int k = 0; k < PB_COUNT; k++) {
+        bench__report(names[k], ms[k], runs);
+        free(ms[k]);
+    }
+}
+
+// NOTE: Static rects on a grid, rects that move back and forth every second,
+// curves on axes of their own and formulas. The formulas are compiled by the
+// first build, the second one takes them over like a reload does.
+static bool bench__synth_script(const char *path, SynthParams p)
+{
+    int seconds = p.frames / 60 + 2;
+    Nob_String_Builder sb = {0};
+    nob_sb_appendf(&sb,
+        "// NOTE: Generated by `bench.bin synth`\n"
+        "const rects_n = %d\n"
+        "const moving_n = %d\n"
+        "const curves_n = %d\n"
+        "const points_n = %d\n"
+        "const typst_n = %d\n"
+        "const seconds = %d\n"
+        "\n", p.rects, p.moving, p.curves, p.points, p.typst, seconds);
+    nob_sb_append_cstr(&sb,
+        "fn grid(n: int, x0: real): []Vec2 {\n"
+        "    pos := make([]Vec2, n)\n"
+        "    side := trunc(sqrt(real(n))) + 1\n"
+        "    for i := 0; i < n; i++ {\n"
+        "        pos[i] = Vec2{x0 + real(i % side) / 10.0, real(i / side) / 10.0 - 5.0}\n"
+        "    }\n"
+        "    return pos\n"
+        "}\n"
+        "\n"
+        "fn sequence(): void {\n"
+        "    if rects_n > 0 {\n"
+        "        fade_in_many(rects(grid(rects_n, -10.0), {Vec2{0.05, 0.05}}))\n"
+        "    }\n"
+        "    from := grid(moving_n, 0.0)\n"
+        "    to := make([]Vec2, moving_n)\n"
+        "    for i := 0; i < moving_n; i++ {\n"
+        "        to[i] = Vec2{from[i].x + 1.0, from[i].y + 0.5}\n"
+        "    }\n"
+        "    moving := rects(from, {Vec2{0.05, 0.05}}, {Color{255, 80, 80, 255}})\n"
+        "    if moving_n > 0 {\n"
+        "        fade_in_many(moving)\n"
+        "    }\n"
+        "    for i := 0; i < curves_n; i++ {\n"
+        "        a := axes(Vec2{real(i % 8) * 10.0, real(i / 8) * 10.0})\n"
+        "        enable(a)\n"
+        "        enable(curve(a, points_n))\n"
+        "    }\n"
+        "    for i := 0; i < typst_n; i++ {\n"
+        "        t := typst(sprintf(\"x^%d + sqrt(%d)\", i, i), 25.0, Vec2{real(i % 10) - 5.0, real(i / 10) - 4.0})\n"
+        "        fade_in(t)\n"
+        "    }\n"
+        "    play(1.0)\n"
+        "\n"
+        "    for s := 1; s < seconds; s++ {\n"
+        "        if moving_n > 0 {\n"
+        "            if s % 2 == 1 {\n"
+        "                move_many(moving, to)\n"
+        "            } else {\n"
+        "                move_many(moving, from)\n"
+        "            }\n"
+        "        }\n"
+        "        play(1.0)\n"
+        "    }\n"
+        "}\n");
+
+    bool ok = mkdir(SP_CACHE_DIR, 0755) == 0 || errno == EEXIST;
+    ok = ok && nob_write_entire_file(path, sb.items, sb.count);
+    nob_sb_free(sb);
+    return ok;
+}
+
+typedef enum {
+    BG_None,
+    BG_Window,
+    BG_Headless,
+} BenchGL;
+
+static const char *bench__gl_names[] = {
+    [BG_None] = "none",
+    [BG_Window] = "window",
+    [BG_Headless] = "headless",
+};
+
+// NOTE: Rendering needs a GL context. raylib only makes one with a window, a
+// hidden one is enough but it still takes a display. Without a display it
+// comes from EGL, which is Mesa's software rasterizer on most machines.
+static BenchGL bench__open_gl(void)
+{
+    if (getenv("DISPLAY") != NULL || getenv("WAYLAND_DISPLAY") != NULL) {
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+        InitWindow(ctx.pres.x, ctx.pres.y, "span bench");
+        if (IsWindowReady()) return BG_Window;
+    }
+    return headless_start(ctx.vres.x, ctx.vres.y) ? BG_Headless : BG_None;
+}
+
+static void bench__close_gl(BenchGL gl)
+{
+    if (gl == BG_Window) CloseWindow();
+    if (gl == BG_Headless) headless_stop();
+}
+
+static void bench__json_build(Nob_String_Builder *sb, const char *name, BenchBuild b)
+{
+    nob_sb_appendf(sb, "    \"%s\": {\"compile_ms\": %.3f, \"sequence_ms\": %.3f},\n",
+        name, b.compile_ms, b.run_ms);
+}
+
+static void bench__json_stage(Nob_String_Builder *sb, BenchStage s, f64 *ms, int n, bool last)
+{
+    const char *sep = last ? "" : ",";
+    // NOTE: Stages that couldn't run are null
+    if (n == 0) {
+        nob_sb_appendf(sb, "    \"%s\": null%s\n", bench__stage_names[s], sep);
+        return;
+    }
+    qsort(ms, n, sizeof(f64), bench__cmp);
+    f64 mean = 0.0;
+    for (int i = 0; i < n; i++) mean += ms[i];
+    mean /= n;
+    nob_sb_appendf(sb,
+        "    \"%s\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}%s\n",
+        bench__stage_names[s], bench__percentile(ms, n, 50.0), bench__percentile(ms, n, 90.0),
+        bench__percentile(ms, n, 99.0), ms[n - 1], mean, sep);
+}
+
+static int bench__synth(int argc, char **argv)
+{
+    SynthParams p = {
+        .rects = argc > 0 ? atoi(argv[0]) : 10000,
+        .moving = argc > 1 ? atoi(argv[1]) : 1000,
+        .curves = argc > 2 ? atoi(argv[2]) : 4,
+        .points = argc > 3 ? atoi(argv[3]) : 350,
+        .typst = argc > 4 ? atoi(argv[4]) : 0,
+        .frames = argc > 5 ? atoi(argv[5]) : 300,
+    };
+    const char *output = argc > 6 ? argv[6] : NULL;
+    if (p.rects < 0 || p.moving < 0 || p.curves < 0 || p.points < 1 || p.typst < 0 || p.frames < 1) {
+        fprintf(stderr, "[ERROR] synth: counts can't be negative, points and frames have to be at least 1\n");
+        return 1;
+    }
+
+    // NOTE: raylib logs to stdout, which is where the JSON goes
+    SetTraceLogLevel(LOG_NONE);
+    ctx.filename = BENCH_SYNTH_SCRIPT;
+    ctx.pres = ctx.vres = (IVector2){ 800, 600 };
+    ctx.fps = 60;
+    ctx.cam.offset = (Vector2){ ctx.vres.x * 0.5f, ctx.vres.y * 0.5f };
+    ctx.cam.zoom = 1.0f;
+    ctx.orig_cam = ctx.cam;
+    ctx.easing = EM_Sine;
+    // NOTE: Given a path, the stages of every frame are traced like in span
+    const char *trace = getenv("SPAN_PROFILE");
+    if (trace != NULL && *trace != '\0' && strcmp(trace, "1") != 0) ctx.profile_trace = trace;
+    sp_trace_thread_begin("main");
+
+    BenchGL gl = bench__open_gl();
+    bool gpu = gl != BG_None;
+    if (!gpu && p.typst > 0) {
+        fprintf(stderr, "[WARNING] synth: formulas can't be uploaded without a GL context, leaving them out\n");
+        p.typst = 0;
+    }
+    if (!bench__synth_script(BENCH_SYNTH_SCRIPT, p)) return 1;
+    if (!spc_load_preamble()) return 1;
+    // NOTE: typst runs in a child process, which would print anything still
+    // sitting in the buffer a second time
+    fflush(stdout);
+
+    BenchBuild first = {0}, reload = {0};
+    if (!bench__build(BENCH_SYNTH_SCRIPT, &first)) return 1;
+    if (gpu) {
+        for (int i = 0; i < ctx.store.typsts.count; i++) spo_typst_upload(&ctx.store.typsts.items[i]);
+    }
+    if (!bench__build(BENCH_SYNTH_SCRIPT, &reload)) return 1;
+    int n = ctx.orig.count;
+
+    RenderTexture rtex = {0};
+    FFMPEG *ffmpeg = NULL;
+    if (gpu) {
+        for (int i = 0; i < ctx.store.typsts.count; i++) spo_typst_upload(&ctx.store.typsts.items[i]);
+        spr_batch_init(&ctx.rect_batch);
+        rtex = LoadRenderTexture(ctx.vres.x, ctx.vres.y);
+        // NOTE: Without ffmpeg the writes fail instead of killing the bench
+        signal(SIGPIPE, SIG_IGN);
+        ffmpeg = ffmpeg_start_rendering_video(BENCH_SYNTH_VIDEO, ctx.vres.x, ctx.vres.y, ctx.fps, NULL);
+    }
+
+    f64 *ms[BS_COUNT] = {0};
+    int samples[BS_COUNT] = {0};
+    for (int s = 0; s < BS_COUNT; s++) {
+        ms[s] = malloc(p.frames * sizeof(f64));
+        SP_ASSERT(ms[s] != NULL && "Buy MORE RAM lol!!");
+    }
+
+    bench__playback_init();
+    spc_reset();
+    f64 dt = 1.0 / ctx.fps;
+    for (int f = 0; f < p.frames; f++) {
+        sp_trace_next_frame();
+        f64 start = sp_now();
+        spc_update(dt);
+        ms[BS_Update][samples[BS_Update]++] = (sp_now() - start) * 1000.0;
+
+        start = sp_now();
+        spg_query(&ctx.grid, spg_view_rect(ctx.cam, ctx.vres));
+        for (int i = 0; i < ctx.grid.visible.count; i++) {
+            Id id = ctx.grid.visible.items[i];
+            if (ctx.store.kind[id] != OK_RECT) continue;
+            const Rect *r = &ctx.store.rects.items[ctx.store.payload[id]];
+            spr_batch_push(&ctx.rect_batch, ctx.state.pos[id], r->size, ctx.state.color[id]);
+        }
+        ctx.rect_batch.pending.count = 0;
+        ms[BS_Cull][samples[BS_Cull]++] = (sp_now() - start) * 1000.0;
+        if (!gpu) continue;
+
+        // NOTE: The draw calls are only queued here, waiting for the GPU to
+        // finish them is part of the readback
+        start = sp_now();
+        BeginTextureMode(rtex); {
+            spc_main_render(ctx.cam, ctx.vres);
+        } EndTextureMode();
+        ms[BS_Render][samples[BS_Render]++] = (sp_now() - start) * 1000.0;
+
+        start = sp_now();
+        Image image = LoadImageFromTexture(rtex.texture);
+        ms[BS_Readback][samples[BS_Readback]++] = (sp_now() - start) * 1000.0;
+        SP_TRACE_END(start, "LoadImageFromTexture");
+
+        if (ffmpeg != NULL) {
+            start = sp_now();
+            bool ok = ffmpeg_send_frame(ffmpeg, image.data, image.width, image.height);
+            ms[BS_Encode][samples[BS_Encode]++] = (sp_now() - start) * 1000.0;
+            SP_TRACE_END(start, "ffmpeg_send_frame");
+            if (!ok) {
+                ffmpeg_end_rendering(ffmpeg, true);
+                ffmpeg = NULL;
+                samples[BS_Encode] = 0;
+            }
+        }
+        UnloadImage(image);
+    }
+    if (ffmpeg != NULL) ffmpeg_end_rendering(ffmpeg, false);
+    remove(BENCH_SYNTH_VIDEO);
+
+    Nob_String_Builder sb = {0};
+    nob_sb_append_cstr(&sb, "{\n");
+    nob_sb_appendf(&sb,
+        "  \"scene\": {\"rects\": %d, \"moving\": %d, \"curves\": %d, \"points\": %d, \"typst\": %d, \"objects\": %d},\n",
+        p.rects, p.moving, p.curves, p.points, p.typst, n);
+    nob_sb_appendf(&sb, "  \"frames\": %d,\n  \"fps\": %d,\n  \"resolution\": [%d, %d],\n  \"gl\": \"%s\",\n",
+        p.frames, ctx.fps, ctx.vres.x, ctx.vres.y, bench__gl_names[gl]);
+    nob_sb_append_cstr(&sb, "  \"build\": {\n");
+    bench__json_build(&sb, "first", first);
+    bench__json_build(&sb, "reload", reload);
+    nob_sb_appendf(&sb, "    \"actions\": %d,\n    \"actions_optimized\": %d\n  },\n",
+        reload.opt.actions_in, reload.opt.actions_out);
+    nob_sb_append_cstr(&sb, "  \"stages_ms\": {\n");
+    for (int s = 0; s < BS_COUNT; s++) {
+        bench__json_stage(&sb, s, ms[s], samples[s], s + 1 == BS_COUNT);
+    }
+    nob_sb_append_cstr(&sb, "  }\n}\n");
+
+    bool ok = true;
+    if (output != NULL) {
+        ok = nob_write_entire_file(output, sb.items, sb.count);
+    } else {
+        fwrite(sb.items, 1, sb.count, stdout);
+    }
+    nob_sb_free(sb);
+    if (ctx.profile_trace != NULL) ok = sp_trace_write(ctx.profile_trace) && ok;
+    for (int s = 0; s < BS_COUNT; s++) free(ms[s]);
+    if (gpu) {
+        UnloadRenderTexture(rtex);
+        spr_batch_deinit(&ctx.rect_batch);
+    }
+    bench__close_gl(gl);
+    return ok ? 0 : 1;
+}
+
+static f32 bench__luma(Color c)
+{
+    return 0.299f*c.r + 0.587f*c.g + 0.114f*c.b;
+}
+
+typedef struct {
+    f64 differing;
+    f64 worst_block;
+} BenchDiff;
+
+// NOTE: `diff` gets the golden frame dimmed, with the pixels that differ in red
+static BenchDiff bench__compare(const Image *got, const Image *want, Image *diff)
+{
+    const Color *g = got->data, *w = want->data;
+    Color *d = diff->data;
+    int width = got->width, height = got->height;
+    BenchDiff r = {0};
+    int differing = 0;
+    for (int i = 0; i < width*height; i++) {
+        int off = abs(g[i].r - w[i].r);
+        off = fmax(off, abs(g[i].g - w[i].g));
+        off = fmax(off, abs(g[i].b - w[i].b));
+        off = fmax(off, abs(g[i].a - w[i].a));
+        if (off > BENCH_GOLDEN_TOLERANCE) {
+            differing++;
+            d[i] = RED;
+        } else {
+            d[i] = (Color){w[i].r / 4, w[i].g / 4, w[i].b / 4, 255};
+        }
+    }
+    r.differing = (f64)differing / (width*height);
+
+    for (int by = 0; by < height; by += BENCH_GOLDEN_BLOCK) {
+        for (int bx = 0; bx < width; bx += BENCH_GOLDEN_BLOCK) {
+            f64 sum = 0.0;
+            int n = 0;
+            for (int y = by; y < by + BENCH_GOLDEN_BLOCK && y < height; y++) {
+                for (int x = bx; x < bx + BENCH_GOLDEN_BLOCK && x < width; x++) {
+                    sum += bench__luma(g[y*width + x]) - bench__luma(w[y*width + x]);
+                    n++;
+                }
+            }
+            r.worst_block = fmax(r.worst_block, fabs(sum / n));
+        }
+    }
+    return r;
+}
+
+// NOTE: Checks one rendered frame against its golden image, or replaces it
+static bool bench__golden_frame(const char *dir, const char *name, int frame, Image *img, bool update)
+{
+    const char *path = nob_temp_sprintf("%s/%d.png", dir, frame);
+    if (update) return ExportImage(*img, path);
+
+    Image want = LoadImage(path);
+    if (!IsImageValid(want)) {
+        printf("%-10s frame %4d FAILED, no golden image at %s\n", name, frame, path);
+        return false;
+    }
+    ImageFormat(&want, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    bool ok = want.width == img->width && want.height == img->height;
+    if (!ok) {
+        printf("%-10s frame %4d FAILED, the golden image is %dx%d\n", name, frame, want.width, want.height);
+        UnloadImage(want);
+        return false;
+    }
+
+    Image diff = GenImageColor(img->width, img->height, BLACK);
+    BenchDiff r = bench__compare(img, &want, &diff);
+    ok = r.differing <= BENCH_GOLDEN_MAX_DIFF && r.worst_block <= BENCH_GOLDEN_PERCEPTUAL;
+    printf("%-10s frame %4d %s, %.4f%% of the pixels differ, worst block is off by %.2f\n",
+        name, frame, ok ? "ok" : "FAILED", r.differing * 100.0, r.worst_block);
+    if (!ok) {
+        const char *got_path = nob_temp_sprintf(SP_CACHE_DIR"/golden-%s-%d.png", name, frame);
+        const char *diff_path = nob_temp_sprintf(SP_CACHE_DIR"/golden-%s-%d-diff.png", name, frame);
+        ExportImage(*img, got_path);
+        ExportImage(diff, diff_path);
+        printf("%-10s            see %s and %s\n", "", got_path, diff_path);
+    }
+    UnloadImage(diff);
+    UnloadImage(want);
+    return ok;
+}
+
+// NOTE: The stages a golden run times, encoding is left to `synth`
+static const BenchStage bench__golden_stages[] = { BS_Update, BS_Cull, BS_Render, BS_Readback };
+
+// NOTE: Baselines are only compared on the GL context and build they were
+// recorded with, which `config` names. Times from another one say nothing.
+static bool bench__golden_perf(const char *dir, const char *name, const char *config, const f64 *p50, bool update)
+{
+    const char *path = nob_temp_sprintf("%s/perf.txt", dir);
+    Nob_String_Builder sb = {0};
+    if (update) {
+        nob_sb_appendf(&sb, "config %s\n", config);
+        for (int i = 0; i < SP_LEN(bench__golden_stages); i++) {
+            BenchStage s = bench__golden_stages[i];
+            nob_sb_appendf(&sb, "%s_ms %.4f\n", bench__stage_names[s], p50[s]);
+        }
+        bool ok = nob_write_entire_file(path, sb.items, sb.count);
+        nob_sb_free(sb);
+        return ok;
+    }
+
+    f64 base[BS_COUNT] = {0};
+    bool found[BS_COUNT] = {0};
+    Nob_String_View recorded = {0};
+    bool ok = nob_read_entire_file(path, &sb);
+    Nob_String_View rest = nob_sv_from_parts(sb.items, sb.count);
+    while (ok && rest.count > 0) {
+        Nob_String_View line = nob_sv_trim(nob_sv_chop_by_delim(&rest, '\n'));
+        Nob_String_View key = nob_sv_chop_by_delim(&line, ' ');
+        if (nob_sv_eq(key, nob_sv_from_cstr("config"))) recorded = line;
+        for (int s = 0; s < BS_COUNT; s++) {
+            if (!nob_sv_eq(key, nob_sv_from_cstr(nob_temp_sprintf("%s_ms", bench__stage_names[s])))) continue;
+            base[s] = strtod(nob_temp_sv_to_cstr(line), NULL);
+            found[s] = true;
+        }
+    }
+    for (int i = 0; i < SP_LEN(bench__golden_stages); i++) ok = ok && found[bench__golden_stages[i]];
+    if (!ok) {
+        printf("%-10s FAILED, no baseline for every stage in %s\n", name, path);
+        nob_sb_free(sb);
+        return false;
+    }
+    if (!nob_sv_eq(recorded, nob_sv_from_cstr(config))) {
+        printf("%-10s times not compared, the baselines are from "SV_Fmt"\n", name, SV_Arg(recorded));
+        printf("%-10s            this is %s, `golden update` records them\n", "", config);
+        nob_sb_free(sb);
+        return true;
+    }
+    nob_sb_free(sb);
+
+    for (int i = 0; i < SP_LEN(bench__golden_stages); i++) {
+        BenchStage s = bench__golden_stages[i];
+        f64 limit = fmax(base[s] * (1.0 + BENCH_GOLDEN_SLACK / 100.0), base[s] + BENCH_GOLDEN_SLACK_MIN_MS);
+        bool fast = p50[s] <= limit;
+        printf("%-10s %-8s p50 %7.3f ms, baseline %7.3f ms, %s\n", name, bench__stage_names[s],
+            p50[s], base[s], fast ? "ok" : "FAILED");
+        ok = ok && fast;
+    }
+    return ok;
+}
+
+// NOTE: Plays the scene like rendering a video does, through the same
+// `spc_main_render` into a render texture and the same readback. The frames
+// are checked on the first run, the times are the best median of all runs.
+static bool bench__golden_scene(const char *script, const int *frames, int n, const char *config, bool update)
+{
+    const char *name = nob_path_name(script);
+    const char *dot = strrchr(name, '.');
+    if (dot != NULL) name = nob_temp_sprintf("%.*s", (int)(dot - name), name);
+    const char *dir = nob_temp_sprintf(BENCH_GOLDEN_DIR"/%s", name);
+    if (update && !nob_mkdir_if_not_exists(dir)) return false;
+
+    BenchBuild b = {0};
+    if (!bench__build(script, &b)) return false;
+    for (int i = 0; i < ctx.store.typsts.count; i++) spo_typst_upload(&ctx.store.typsts.items[i]);
+    bench__playback_init();
+
+    int count = frames[n - 1] + 1;
+    f64 *ms[BS_COUNT] = {0};
+    f64 p50[BS_COUNT] = {0};
+    for (int i = 0; i < SP_LEN(bench__golden_stages); i++) {
+        BenchStage s = bench__golden_stages[i];
+        ms[s] = malloc(count * sizeof(f64));
+        SP_ASSERT(ms[s] != NULL && "Buy MORE RAM lol!!");
+        p50[s] = INFINITY;
+    }
+
+    RenderTexture rtex = LoadRenderTexture(ctx.vres.x, ctx.vres.y);
+    f64 dt = 1.0 / ctx.fps;
+    bool ok = true;
+    for (int run = 0; run < BENCH_GOLDEN_RUNS; run++) {
+        spc_reset();
+        int next = 0;
+        for (int f = 0; f < count; f++) {
+            f64 start = sp_now();
+            spc_update(dt);
+            ms[BS_Update][f] = (sp_now() - start) * 1000.0;
+
+            start = sp_now();
+            spg_query(&ctx.grid, spg_view_rect(ctx.cam, ctx.vres));
+            ms[BS_Cull][f] = (sp_now() - start) * 1000.0;
+
+            start = sp_now();
+            BeginTextureMode(rtex); {
+                spc_main_render(ctx.cam, ctx.vres);
+            } EndTextureMode();
+            ms[BS_Render][f] = (sp_now() - start) * 1000.0;
+
+            start = sp_now();
+            Image img = LoadImageFromTexture(rtex.texture);
+            ms[BS_Readback][f] = (sp_now() - start) * 1000.0;
+
+            if (run == 0 && f == frames[next]) {
+                // NOTE: Render textures are stored bottom row first
+                ImageFlipVertical(&img);
+                ok = bench__golden_frame(dir, name, f, &img, update) && ok;
+                next++;
+            }
+            UnloadImage(img);
+        }
+        for (int i = 0; i < SP_LEN(bench__golden_stages); i++) {
+            f64 *m = ms[bench__golden_stages[i]];
+            qsort(m, count, sizeof(f64), bench__cmp);
+            p50[bench__golden_stages[i]] = fmin(p50[bench__golden_stages[i]], bench__percentile(m, count, 50.0));
+        }
+    }
+    ok = bench__golden_perf(dir, name, config, p50, update) && ok;
+    if (update) printf("%-10s updated %d frames and the baseline in %s\n", name, n, dir);
+
+    UnloadRenderTexture(rtex);
+    for (int i = 0; i < SP_LEN(bench__golden_stages); i++) free(ms[bench__golden_stages[i]]);
+    return ok;
+}
+
+// NOTE: Names the GL context and the build the times are taken with
+static void bench__golden_config(BenchGL gl, char *config, size_t size)
+{
+    const char *renderer = gl == BG_Headless ? headless_renderer() : NULL;
+#ifdef __OPTIMIZE__
+    const char *build = "optimized";
+#else
+    const char *build = "unoptimized";
+#endif
+    snprintf(config, size, "%s %s, cc %s, %s, SP_TRACE=%d", bench__gl_names[gl],
+        renderer != NULL ? renderer : "", __VERSION__, build, SP_TRACE);
+}
+
+static int bench__cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int bench__golden(int argc, char **argv)
+{
+    bool update = argc > 0 && strcmp(argv[0], "update") == 0;
+
+    SetTraceLogLevel(LOG_WARNING);
+    ctx.pres = ctx.vres = (IVector2){ 800, 600 };
+    ctx.fps = 60;
+    ctx.cam.offset = (Vector2){ ctx.vres.x * 0.5f, ctx.vres.y * 0.5f };
+    ctx.cam.zoom = 1.0f;
+    ctx.orig_cam = ctx.cam;
+    ctx.easing = EM_Sine;
+    if (!spc_load_preamble()) return 1;
+    if (!nob_mkdir_if_not_exists(SP_CACHE_DIR)) return 1;
+    // NOTE: typst runs in a child process, which would print anything still
+    // sitting in the buffer a second time
+    fflush(stdout);
+
+    Nob_String_Builder manifest = {0};
+    if (!nob_read_entire_file(BENCH_GOLDEN_MANIFEST, &manifest)) return 1;
+    BenchGL gl = bench__open_gl();
+    if (gl == BG_None) {
+        fprintf(stderr, "[ERROR] golden: could not make a GL context to render the scenes in\n");
+        nob_sb_free(manifest);
+        return 1;
+    }
+    spr_batch_init(&ctx.rect_batch);
+    char config[256];
+    bench__golden_config(gl, config, sizeof(config));
+
+    Nob_String_View rest = nob_sv_from_parts(manifest.items, manifest.count);
+    bool ok = true;
+    int scenes = 0;
+    while (rest.count > 0) {
+        Nob_String_View line = nob_sv_trim(nob_sv_chop_by_delim(&rest, '\n'));
+        if (line.count == 0 || nob_sv_starts_with(line, nob_sv_from_cstr("//"))) continue;
+
+        const char *script = nob_temp_sv_to_cstr(nob_sv_chop_by_delim(&line, ' '));
+        int frames[BENCH_GOLDEN_MAX_FRAMES];
+        int n = 0;
+        while (line.count > 0 && n < BENCH_GOLDEN_MAX_FRAMES) {
+            Nob_String_View word = nob_sv_chop_by_delim(&line, ' ');
+            line = nob_sv_trim_left(line);
+            if (word.count > 0) frames[n++] = atoi(nob_temp_sv_to_cstr(word));
+        }
+        if (n == 0 || frames[0] < 0) {
+            fprintf(stderr, "[ERROR] golden: %s needs frames to check, none of them negative\n", script);
+            ok = false;
+            continue;
+        }
+        qsort(frames, n, sizeof(int), bench__cmp_int);
+        ctx.filename = script;
+        ok = bench__golden_scene(script, frames, n, config, update) && ok;
+        scenes++;
+        nob_temp_reset();
+    }
+    nob_sb_free(manifest);
+    spr_batch_deinit(&ctx.rect_batch);
+    bench__close_gl(gl);
+
+    printf("%d scenes %s\n", scenes, ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "synth") == 0) return bench__synth(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "golden") == 0) return bench__golden(argc - 2, argv + 2);
+
+    const char *filename = argc > 1 ? argv[1] : "./test.um";
+    int runs = argc > 2 ? atoi(argv[2]) : BENCH_RUNS;
+    if (runs < 2) runs = 2;
+
+    SetTraceLogLevel(LOG_WARNING);
+    ctx.filename = filename;
+    ctx.pres = ctx.vres = (IVector2){ 800, 600 };
+    ctx.cam.offset = (Vector2){ ctx.vres.x * 0.5f, ctx.vres.y * 0.5f };
+    ctx.cam.zoom = 1.0f;
+    ctx.orig_cam = ctx.cam;
+    ctx.easing = EM_Sine;
+    if (argc > 3) ctx.umka_stack_size = atoi(argv[3]);
+
+    f64 start = sp_now();
+    if (!spc_load_preamble()) return 1;
+    f64 preamble_ms = (sp_now() - start) * 1000.0;
+    start = sp_now();
+    spc_load_preamble();
+    printf("%-10s cold %7.3f ms, cached %7.3f ms\n", "preamble", preamble_ms, (sp_now() - start) * 1000.0);
+    // NOTE: typst runs in a child process, which would print anything still
+    // sitting in the buffer a second time
+    fflush(stdout);
+
+    f64 *compile_ms = malloc(runs * sizeof(f64));
+    f64 *first_ms = malloc(runs * sizeof(f64));
+    f64 *run_ms = malloc(runs * sizeof(f64));
+    SP_ASSERT(compile_ms != NULL && first_ms != NULL && run_ms != NULL && "Buy MORE RAM lol!!");
+    BenchBuild b = {0};
+
+    for (int i = 0; i < runs; i++) {
+        if (!bench__build(filename, &b)) return 1;
+        compile_ms[i] = b.compile_ms;
+        first_ms[i] = b.first_ms;
+        run_ms[i] = b.run_ms;
+    }
+
+    printf("%s, %d runs, %d KiB umka stack\n", filename, runs,
+        (ctx.umka_stack_size > 0 ? ctx.umka_stack_size : SP_UMKA_STACK_SIZE) * (int)sizeof(UmkaStackSlot) / 1024);
+    bench__report("compile", compile_ms, runs);
+    // NOTE: How much of the sequence has to run before the first frame
+    bench__report("first", first_ms, runs);
+    bench__report("sequence", run_ms, runs);
+    printf("%d actions, %d after optimizing\n", b.opt.actions_in, b.opt.actions_out);
+    free(compile_ms);
+    free(first_ms);
+    free(run_ms);
+
+    bench__playback(runs);
+
+    umkaFree(ctx.umka);
+    bench__free_arena(ctx.scene_arena);
+    free(ctx.preamble.source);
+    return 0;
+}
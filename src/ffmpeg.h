@@ -8,7 +8,7 @@
 
 typedef struct FFMPEG FFMPEG;
 
-FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size_t height, size_t fps);
+FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size_t height, size_t fps, const char *preset);
 FFMPEG *ffmpeg_start_rendering_audio(const char *output_path);
 bool ffmpeg_send_frame(FFMPEG *ffmpeg, void *data, size_t width, size_t height);
 bool ffmpeg_send_sound_samples(FFMPEG *ffmpeg, void *data, size_t size);
@@ -23,7 +23,7 @@ struct FFMPEG {
     pid_t pid;
 };
 
-FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size_t height, size_t fps)
+FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size_t height, size_t fps, const char *preset)
 {
     int pipefd[2];
 
@@ -63,6 +63,7 @@ FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size
             "-i", "-",
 
             "-c:v", "libx264",
+            "-preset", preset != NULL ? preset : "medium",
             "-vb", "2500k",
             "-c:a", "aac",
             "-ab", "200k",
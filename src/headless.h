@@ -0,0 +1,14 @@
+#ifndef HEADLESS_H_
+#define HEADLESS_H_
+
+#include <stdbool.h>
+
+// NOTE: A GL context without a window or a display, made through EGL with
+// Mesa's surfaceless platform. raylib draws into render textures in it like it
+// does with a window, there's just no screen to draw to.
+bool headless_start(int width, int height);
+// NOTE: What draws, as GL_RENDERER names it, NULL before `headless_start`
+const char *headless_renderer(void);
+void headless_stop(void);
+
+#endif // HEADLESS_H_
@@ -0,0 +1,127 @@
+#include <dlfcn.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <raylib.h>
+#include "rlgl.h"
+
+#include "headless.h"
+
+// NOTE: raylib does these itself once it has a window, and only uploads
+// textures after `isGpuReady` is set
+extern bool isGpuReady;
+void LoadFontDefault(void);
+void UnloadFontDefault(void);
+
+// NOTE: libEGL is only opened when there's no display, so span doesn't need
+// it to start at all
+typedef struct {
+    void *lib;
+    EGLDisplay display;
+    EGLContext context;
+    PFNEGLGETPROCADDRESSPROC get_proc;
+    PFNEGLTERMINATEPROC terminate;
+    PFNEGLDESTROYCONTEXTPROC destroy_context;
+    PFNEGLMAKECURRENTPROC make_current;
+} Headless;
+
+static Headless headless;
+
+// NOTE: `fn` points to the function pointer, which ISO C can't take from a
+// `void *` directly
+static bool headless__load(void *fn, const char *name)
+{
+    void *sym = dlsym(headless.lib, name);
+    if (sym == NULL) TraceLog(LOG_WARNING, "HEADLESS: %s is missing from libEGL", name);
+    memcpy(fn, &sym, sizeof(sym));
+    return sym != NULL;
+}
+
+bool headless_start(int width, int height)
+{
+    headless.lib = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (headless.lib == NULL) {
+        TraceLog(LOG_WARNING, "HEADLESS: Could not open libEGL: %s", dlerror());
+        return false;
+    }
+
+    PFNEGLINITIALIZEPROC initialize;
+    PFNEGLBINDAPIPROC bind_api;
+    PFNEGLCREATECONTEXTPROC create_context;
+    bool loaded = headless__load(&initialize, "eglInitialize")
+        && headless__load(&bind_api, "eglBindAPI")
+        && headless__load(&create_context, "eglCreateContext")
+        && headless__load(&headless.get_proc, "eglGetProcAddress")
+        && headless__load(&headless.terminate, "eglTerminate")
+        && headless__load(&headless.destroy_context, "eglDestroyContext")
+        && headless__load(&headless.make_current, "eglMakeCurrent");
+    if (!loaded) {
+        headless_stop();
+        return false;
+    }
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)headless.get_proc("eglGetPlatformDisplayEXT");
+    if (get_display != NULL) {
+        headless.display = get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (headless.display == EGL_NO_DISPLAY || !initialize(headless.display, NULL, NULL)) {
+        TraceLog(LOG_WARNING, "HEADLESS: There's no surfaceless EGL display");
+        headless.display = EGL_NO_DISPLAY;
+        headless_stop();
+        return false;
+    }
+
+    // NOTE: The same version raylib asks GLFW for
+    EGLint attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    bool ok = bind_api(EGL_OPENGL_API);
+    if (ok) headless.context = create_context(headless.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    ok = ok && headless.context != EGL_NO_CONTEXT;
+    ok = ok && headless.make_current(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context);
+    if (!ok) {
+        TraceLog(LOG_WARNING, "HEADLESS: Could not make an OpenGL 3.3 context without a surface");
+        headless_stop();
+        return false;
+    }
+
+    void *loader;
+    memcpy(&loader, &headless.get_proc, sizeof(loader));
+    rlLoadExtensions(loader);
+    rlglInit(width, height);
+    isGpuReady = true;
+    LoadFontDefault();
+    TraceLog(LOG_INFO, "HEADLESS: Drawing without a window, %dx%d", width, height);
+    return true;
+}
+
+const char *headless_renderer(void)
+{
+    if (headless.context == EGL_NO_CONTEXT) return NULL;
+    // NOTE: From GL/gl.h, which span doesn't include anywhere else
+    typedef const unsigned char *(*GetStringProc)(unsigned int name);
+    const unsigned int gl_renderer = 0x1F01;
+    GetStringProc get_string = (GetStringProc)headless.get_proc("glGetString");
+    return get_string != NULL ? (const char *)get_string(gl_renderer) : NULL;
+}
+
+void headless_stop(void)
+{
+    if (headless.context != EGL_NO_CONTEXT) {
+        UnloadFontDefault();
+        rlglClose();
+        isGpuReady = false;
+        headless.make_current(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        headless.destroy_context(headless.display, headless.context);
+    }
+    if (headless.display != EGL_NO_DISPLAY) headless.terminate(headless.display);
+    if (headless.lib != NULL) dlclose(headless.lib);
+    headless = (Headless){0};
+}
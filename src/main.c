@@ -1,16 +1,139 @@
+#include <limits.h>
 #include "raylib.h"
 #define ARENA_IMPLEMENTATION
 #include "span.h"
 #define NOB_IMPLEMENTATION
 #include "../nob.h"
 
-int main(void)
+static void main__usage(const char *program)
 {
-    const char *filename = "./test.um";
-    bool success = spc_init(filename, RM_Preview);
+    printf("Usage: %s [options] [script.um]\n", program);
+    printf("Plays ./test.um when no script is given.\n");
+    printf("  --mode preview|output  Preview in a window, the default, or render a video\n");
+    printf("  --output PATH          Where the video goes, %s by default\n", SP_OUTPUT_PATH);
+    printf("  --resolution WxH       Of the video, or of the window when previewing\n");
+    printf("  --fps N                %d by default\n", SP_FPS);
+    printf("  --preset NAME          x264 preset of the video, medium by default\n");
+    printf("  --from TIME            Start there instead of at the beginning\n");
+    printf("  --to TIME              Stop rendering there, or pause the preview\n");
+    printf("  --umka-stack SLOTS     Size of the Umka stack, %d by default\n", SP_UMKA_STACK_SIZE);
+    printf("TIME is in seconds, as [[h:]m:]s, or task:N for where task N starts.\n");
+}
+
+static bool main__parse_time(const char *arg, TimePoint *point)
+{
+    char *end;
+    if (strncmp(arg, "task:", 5) == 0) {
+        long index = strtol(arg + 5, &end, 10);
+        if (end == arg + 5 || *end != '\0' || index < 0) return false;
+        *point = (TimePoint){ .set = true, .task = true, .value = (f64)index };
+        return true;
+    }
+
+    f64 value = 0.0;
+    for (const char *p = arg;; p = end + 1) {
+        f64 part = strtod(p, &end);
+        if (end == p || part < 0.0) return false;
+        value = value * 60.0 + part;
+        if (*end == '\0') break;
+        if (*end != ':') return false;
+    }
+    *point = (TimePoint){ .set = true, .value = value };
+    return true;
+}
+
+static bool main__parse_int(const char *arg, int *n)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value <= 0 || value > INT_MAX) return false;
+    *n = (int)value;
+    return true;
+}
+
+static bool main__parse_args(int argc, char **argv, SpanOptions *opts)
+{
+    const char *program = nob_shift_args(&argc, &argv);
+    while (argc > 0) {
+        const char *flag = nob_shift_args(&argc, &argv);
+        if (strcmp(flag, "-h") == 0 || strcmp(flag, "--help") == 0) {
+            main__usage(program);
+            exit(0);
+        }
+        if (flag[0] != '-') {
+            opts->filename = flag;
+            continue;
+        }
+        if (argc == 0) {
+            fprintf(stderr, "[ERROR] %s needs a value, see %s --help\n", flag, program);
+            return false;
+        }
+
+        const char *value = nob_shift_args(&argc, &argv);
+        bool ok = true;
+        if (strcmp(flag, "--mode") == 0) {
+            if (strcmp(value, "preview") == 0) opts->mode = RM_Preview;
+            else if (strcmp(value, "output") == 0) opts->mode = RM_Output;
+            else ok = false;
+        } else if (strcmp(flag, "--output") == 0) {
+            opts->output = value;
+        } else if (strcmp(flag, "--resolution") == 0) {
+            char rest;
+            IVector2 *res = &opts->resolution;
+            ok = sscanf(value, "%dx%d%c", &res->x, &res->y, &rest) == 2 && res->x > 0 && res->y > 0;
+        } else if (strcmp(flag, "--fps") == 0) {
+            ok = main__parse_int(value, &opts->fps);
+        } else if (strcmp(flag, "--preset") == 0) {
+            opts->preset = value;
+        } else if (strcmp(flag, "--from") == 0) {
+            ok = main__parse_time(value, &opts->from);
+        } else if (strcmp(flag, "--to") == 0) {
+            ok = main__parse_time(value, &opts->to);
+        } else if (strcmp(flag, "--umka-stack") == 0) {
+            ok = main__parse_int(value, &opts->umka_stack_size);
+        } else {
+            fprintf(stderr, "[ERROR] Unknown option %s, see %s --help\n", flag, program);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "[ERROR] Invalid value for %s: %s\n", flag, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: Every frame is a frame of the video, however long it takes to draw.
+// Without a window, nothing but the end of the range or ffmpeg stops it.
+static void main__render_video(void)
+{
+    f64 dt = 1.0 / ctx.fps;
+    while (!ctx.quit && (ctx.headless || !WindowShouldClose())) {
+        spc_update(dt);
+        if (ctx.paused) break;
+        spc_render();
+        if (spc_time() >= ctx.render_end) break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    SpanOptions opts = { .filename = "./test.um" };
+    if (!main__parse_args(argc, argv, &opts)) return 1;
+    bool success = spc_init(&opts);
     if (!success) return 1;
 
+    if (ctx.render_mode == RM_Output) {
+        main__render_video();
+        spc_deinit();
+        return 0;
+    }
+
+    f64 prev_time = GetTime();
     while (!ctx.quit && !WindowShouldClose()) {
+        if (GetKeyPressed() != 0 || IsWindowResized()) {
+            ctx.dirty = true;
+        }
         if (IsKeyPressed(KEY_SPACE)) {
             ctx.paused = !ctx.paused;
         }
@@ -26,20 +149,37 @@ int main(void)
             spc_reset();
             printf("Restarted animation\n");
         }
+        if (IsKeyPressed(KEY_R) && ctx.render_mode == RM_Preview) {
+            spc_toggle_dynres();
+            printf("Dynamic resolution %s\n", ctx.dynres.enabled ? "on" : "off");
+        }
+        if (IsKeyPressed(KEY_P) && ctx.render_mode == RM_Preview) {
+            ctx.hud.shown = !ctx.hud.shown;
+        }
         if (IsKeyPressed(KEY_C)) {
-            spc_clear_for_recomp();
-            spc_umka_init(filename);
-            spc_run_umka();
-            printf("Recompiled %s\n", filename);
+            spc_request_reload();
         }
+        spc_poll_reload();
 
+        f64 now = GetTime();
+        f32 dt = (f32)(now - prev_time);
+        prev_time = now;
         if (!ctx.paused) {
             SP_ASSERT(ctx.dt_mul != 0);
             f32 mult = ctx.dt_mul > 0 ? (f32)ctx.dt_mul : 1.0 / (f32)abs(ctx.dt_mul);
-            spc_update(GetFrameTime() * mult);
+            spc_update(dt * mult);
+            if (spc_time() >= ctx.render_end) ctx.paused = true;
+            ctx.dirty = true;
         }
 
-        spc_render();
+        if (ctx.dirty) {
+            spc_render();
+            ctx.dirty = false;
+        } else {
+            spc_idle();
+            // NOTE: The time spent idling is not part of the animation
+            prev_time = GetTime();
+        }
     }
 
     spc_deinit();
@@ -1,107 +1,536 @@
+#include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "span.h"
 #include "ffmpeg.h"
+#include "headless.h"
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 #include "umka_api.h"
 #include "../nob.h"
 
 Arena arena = {0};
 Context ctx = {0};
 
-bool spc_init(const char *filename, RenderMode mode)
+static void spc__recycle_arena(Arena *a)
+{
+    if (a == NULL) return;
+    if (ctx.spare_arena == NULL) {
+        arena_reset(a);
+        ctx.spare_arena = a;
+    } else {
+        arena_free(a);
+        free(a);
+    }
+}
+
+Scene *spc_new_scene(void)
+{
+    Scene *sc = malloc(sizeof(Scene));
+    SP_ASSERT(sc != NULL && "Buy MORE RAM lol!!");
+    *sc = (Scene){0};
+    sc->arena = ctx.spare_arena;
+    ctx.spare_arena = NULL;
+    if (sc->arena == NULL) {
+        sc->arena = calloc(1, sizeof(Arena));
+        SP_ASSERT(sc->arena != NULL && "Buy MORE RAM lol!!");
+    }
+    sc->task_arena = sc->arena;
+    sc->profile.enabled = ctx.profile;
+    return sc;
+}
+
+static void spc__set_resolutions(RenderMode mode, IVector2 res)
+{
+    switch (mode) {
+        case RM_Preview: {
+            ctx.pres = res.x > 0 && res.y > 0 ? res : SP_PREVIEW_RES;
+            ctx.vres = ctx.pres;
+        } break;
+
+        case RM_Output: {
+            ctx.vres = res.x > 0 && res.y > 0 ? res : SP_OUTPUT_RES;
+            ctx.pres = (IVector2){
+                (int)roundf((f32)ctx.vres.x * SP_OUTPUT_LAYOUT_HEIGHT / (f32)ctx.vres.y),
+                SP_OUTPUT_LAYOUT_HEIGHT,
+            };
+        } break;
+
+        default: {
+            SP_UNREACHABLEF("Unknown mode of render: %d", mode);
+        } break;
+    }
+}
+
+// NOTE: Only looks at the `import` declarations a module starts with, which
+// Umka requires to come before anything else. A group is `import ( ... )`,
+// each entry optionally named with `name = "path"`.
+typedef struct {
+    const char *src;
+    size_t size, at;
+    bool in_group;
+    // NOTE: Where the last complete declaration ends
+    size_t end;
+} ImportScan;
+
+static void spu__skip_space(ImportScan *s)
+{
+    while (s->at < s->size) {
+        const char *c = s->src + s->at;
+        size_t left = s->size - s->at;
+        if (isspace((unsigned char)*c) || *c == ';') {
+            s->at++;
+        } else if (left >= 2 && c[0] == '/' && c[1] == '/') {
+            while (s->at < s->size && s->src[s->at] != '\n') s->at++;
+        } else if (left >= 2 && c[0] == '/' && c[1] == '*') {
+            s->at += 2;
+            while (s->at + 1 < s->size && !(s->src[s->at] == '*' && s->src[s->at + 1] == '/')) s->at++;
+            s->at = s->at + 2 < s->size ? s->at + 2 : s->size;
+        } else {
+            break;
+        }
+    }
+}
+
+static bool spu__is_ident(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// NOTE: Skips the `name =` an import can start with
+static void spu__skip_alias(ImportScan *s)
+{
+    size_t name = s->at;
+    while (s->at < s->size && spu__is_ident(s->src[s->at])) s->at++;
+    spu__skip_space(s);
+    if (s->at < s->size && s->src[s->at] == '=') {
+        s->at++;
+        spu__skip_space(s);
+    } else {
+        s->at = name;
+    }
+}
+
+static bool spu__scan_string(ImportScan *s, const char **str, int *len)
+{
+    if (s->at >= s->size || s->src[s->at] != '"') return false;
+    size_t start = ++s->at;
+    while (s->at < s->size && s->src[s->at] != '"' && s->src[s->at] != '\n') s->at++;
+    if (s->at >= s->size || s->src[s->at] != '"') return false;
+    *str = s->src + start;
+    *len = (int)(s->at - start);
+    s->at++;
+    return true;
+}
+
+static bool spu__next_import(ImportScan *s, const char **path, int *len)
+{
+    for (;;) {
+        spu__skip_space(s);
+        if (s->in_group) {
+            if (s->at < s->size && s->src[s->at] == ')') {
+                s->at++;
+                s->in_group = false;
+                s->end = s->at;
+                continue;
+            }
+            spu__skip_alias(s);
+            return spu__scan_string(s, path, len);
+        }
+
+        if (s->size - s->at < 6 || memcmp(s->src + s->at, "import", 6) != 0) return false;
+        if (s->size - s->at > 6 && spu__is_ident(s->src[s->at + 6])) return false;
+        s->at += 6;
+        spu__skip_space(s);
+        if (s->at < s->size && s->src[s->at] == '(') {
+            s->at++;
+            s->in_group = true;
+            continue;
+        }
+        spu__skip_alias(s);
+        if (!spu__scan_string(s, path, len)) return false;
+        s->end = s->at;
+        return true;
+    }
+}
+
+static Source *spc__source(const char *path)
+{
+    char real[PATH_MAX];
+    struct stat st;
+    if (realpath(path, real) == NULL || stat(real, &st) != 0) return NULL;
+
+    Source *src = NULL;
+    for (int i = 0; i < ctx.sources.count && src == NULL; i++) {
+        if (strcmp(ctx.sources.items[i].path, real) == 0) src = &ctx.sources.items[i];
+    }
+    if (src == NULL) {
+        Source fresh = { .path = arena_strdup(&ctx.source_arena, real) };
+        arena_da_append(&ctx.source_arena, &ctx.sources, fresh);
+        src = &ctx.sources.items[ctx.sources.count - 1];
+    }
+
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (src->data != NULL && src->size == (size_t)st.st_size && src->mtime == mtime) return src;
+
+    if (src->data != NULL && src->size > 0) munmap((void *)src->data, src->size);
+    src->data = "";
+    src->size = 0;
+    if (st.st_size > 0) {
+        int fd = open(real, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "[ERROR] Could not open '%s': %s\n", real, strerror(errno));
+            src->data = NULL;
+            return NULL;
+        }
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "[ERROR] Could not map '%s': %s\n", real, strerror(errno));
+            src->data = NULL;
+            return NULL;
+        }
+        src->data = data;
+        src->size = st.st_size;
+    }
+    src->mtime = mtime;
+    src->hash = sp_hash(SP_HASH_INIT, src->data, src->size);
+    return src;
+}
+
+typedef struct {
+    uint64_t hash;
+    // NOTE: Some module imports the preamble as `SP_PREAMBLE_MODULE`
+    bool imports_preamble;
+} SourceWalk;
+
+// NOTE: Visits `path` and every module it imports, depth first and in the
+// order they're imported, and folds their hashes into the walk. Imports that
+// don't resolve to a file are left for Umka to report.
+static Source *spc__walk_from(const char *path, SourceWalk *w)
+{
+    Source *src = spc__source(path);
+    if (src == NULL || src->walk == ctx.source_walk) return src;
+    src->walk = ctx.source_walk;
+    w->hash = sp_hash(w->hash, src->path, strlen(src->path));
+    w->hash = sp_hash(w->hash, &src->hash, sizeof(src->hash));
+
+    // NOTE: Appending sources moves them, so only indices survive the recursion
+    int index = src - ctx.sources.items;
+    const char *slash = strrchr(src->path, '/');
+    int dir_len = (int)(slash - src->path) + 1;
+    ImportScan scan = { .src = src->data, .size = src->size };
+    const char *import;
+    int len;
+    while (spu__next_import(&scan, &import, &len)) {
+        // NOTE: The preamble is added to Umka as a module of its own, which
+        // is what this name refers to from any directory. It's part of the
+        // key anyway, see `spu_content_w_preamble`.
+        if (strlen(SP_PREAMBLE_MODULE) == (size_t)len && memcmp(import, SP_PREAMBLE_MODULE, len) == 0) {
+            w->imports_preamble = true;
+            continue;
+        }
+
+        const Source *from = &ctx.sources.items[index];
+        char next[PATH_MAX];
+        if (len > 0 && import[0] == '/') {
+            snprintf(next, sizeof(next), "%.*s", len, import);
+        } else {
+            snprintf(next, sizeof(next), "%.*s%.*s", dir_len, from->path, len, import);
+        }
+        spc__walk_from(next, w);
+        scan.src = ctx.sources.items[index].data;
+    }
+    return &ctx.sources.items[index];
+}
+
+static Source *spc__walk_sources(const char *path, SourceWalk *w)
+{
+    ctx.source_walk++;
+    *w = (SourceWalk){ .hash = SP_HASH_INIT };
+    return spc__walk_from(path, w);
+}
+
+// NOTE: Picks up the modules the last build imported for the first time
+static void spc__watch_sources(void)
+{
+    for (int i = 0; i < ctx.sources.count && ctx.reload.watcher != NULL; i++) {
+        Source *src = &ctx.sources.items[i];
+        if (src->watched || src->walk != ctx.source_walk) continue;
+        src->watched = true;
+        watch_add(ctx.reload.watcher, src->path);
+    }
+}
+
+static void spc__renderer_close(void)
+{
+    if (ctx.headless) headless_stop();
+    else CloseWindow();
+}
+
+bool spc_init(const SpanOptions *opts)
 {
     // NOTE: The initialization goes through three steps:
-    //   (1) Umka: compile script, load objs and actions
+    //   (1) Umka: compile script
     //   (2) Raylib: initialize window and other related things
+    //   (3) Umka: run the sequence to load objs and actions
 
     ctx = (Context){0};
     ctx.umka = NULL;
+    const char *filename = opts->filename;
+    RenderMode mode = opts->mode;
+    ctx.filename = filename;
     ctx.easing = EM_Sine;
     ctx.dt_mul = 1;
+    ctx.fps = opts->fps > 0 ? opts->fps : SP_FPS;
+    ctx.output = opts->output != NULL ? opts->output : SP_OUTPUT_PATH;
+    ctx.preset = opts->preset;
+    ctx.umka_stack_size = opts->umka_stack_size;
+    ctx.forward_only = mode == RM_Output;
+    const char *profile = getenv("SPAN_PROFILE");
+    if (profile != NULL && *profile != '\0') {
+        ctx.profile = true;
+        if (strcmp(profile, "1") != 0) ctx.profile_trace = profile;
+    }
+    sp_trace_thread_begin("main");
+    // NOTE: The resolutions are part of the cache key, so they're needed
+    // before the window exists
+    spc__set_resolutions(mode, opts->resolution);
 
-    bool ok = spc_umka_init(filename);
-    if (!ok) return false;
+    // NOTE: With a fresh scene cache, steps (1) and (3) are skipped
+    Scene *sc = spc_new_scene();
+    char *content = NULL;
+    bool ok = spc_load_preamble() && spu_content_w_preamble(sc, filename, &content);
+    if (!ok) {
+        sps_free(sc);
+        return false;
+    }
+
+    Scene *cached = spc_cache_load(sc->cache_key);
+    if (cached != NULL) {
+        sps_free(sc);
+        sc = cached;
+    } else if (!spc_umka_compile(sc, content)) {
+        sps_free(sc);
+        return false;
+    }
 
-    spc_renderer_init(mode);
+    if (!spc_renderer_init(mode)) {
+        sps_free(sc);
+        return false;
+    }
 
-    spc_run_umka();
+    ok = sc->done || spc_run_umka(sc);
+    if (!ok) {
+        sps_free(sc);
+        spc__renderer_close();
+        return false;
+    }
+    spc_swap_scene(sc);
+
+    // NOTE: The part before `from` is only seeked through. It starts on a
+    // frame of the whole video, so the frames are the same as the ones there.
+    f64 from = 0.0, to = INFINITY;
+    ok = !opts->from.set || spc_time_of(opts->from, &from);
+    if (!ok) fprintf(stderr, "[ERROR] --from is past the end of %s\n", filename);
+    if (ok && opts->to.set && !spc_time_of(opts->to, &to)) {
+        fprintf(stderr, "[ERROR] --to is past the end of %s\n", filename);
+        ok = false;
+    }
+    from = floor(from * ctx.fps + 0.5) / ctx.fps;
+    if (ok && to <= from) {
+        fprintf(stderr, "[ERROR] --to has to come after --from, which starts at %.3f s\n", from);
+        ok = false;
+    }
+    if (ok && mode == RM_Output) {
+        ctx.ffmpeg = ffmpeg_start_rendering_video(
+            ctx.output, (size_t)ctx.vres.x, (size_t)ctx.vres.y, (size_t)ctx.fps, ctx.preset);
+        ok = ctx.ffmpeg != NULL;
+    }
+    if (!ok) {
+        spc_deinit();
+        return false;
+    }
+    ctx.render_end = to;
+    if (from > 0.0) spc_seek(from);
+
+    if (mode == RM_Preview) {
+        const char *paths[] = { filename, SP_PREAMBLE_PATH };
+        ctx.reload.watcher = watch_start(paths, SP_LEN(paths));
+        // NOTE: The script itself is already watched
+        if (ctx.sources.count > 0) ctx.sources.items[0].watched = true;
+        spc__watch_sources();
+    }
     return true;
 }
 
-bool spc_umka_init(const char *filename)
+// NOTE: Every instance has to register these again, Umka has no way of
+// sharing them between instances.
+#define X(name, func) {name, &func},
+static const UmkaFunc spu__externs[] = { SPU_EXTERNS(X) };
+#undef X
+
+// NOTE: The same externs, wrapped to be measured. Updaters call some of them
+// after the scene is gone, those calls aren't counted.
+#define X(name, func)                                                  \
+    static void spu__prof_##func(UmkaStackSlot *p, UmkaStackSlot *r)   \
+    {                                                                  \
+        Scene *sc = umkaGetMetadata(umkaGetInstance(r));               \
+        if (sc == NULL) {                                              \
+            func(p, r);                                                \
+            return;                                                    \
+        }                                                              \
+        size_t used = sp_arena_used(sc->arena);                       \
+        f64 start = sp_now();                                          \
+        func(p, r);                                                    \
+        ProfileEntry *e = &sc->profile.externs[SPX_##func];            \
+        e->calls++;                                                    \
+        e->time += sp_now() - start;                                   \
+        e->bytes += sp_arena_used(sc->arena) - used;                  \
+        SP_TRACE_END(start, name);                                     \
+    }
+SPU_EXTERNS(X)
+#undef X
+
+#define X(name, func) {name, &spu__prof_##func},
+static const UmkaFunc spu__prof_externs[] = { SPU_EXTERNS(X) };
+#undef X
+
+bool spc_load_preamble(void)
 {
-    char *content = NULL;
-    bool ok = spu_content_w_preamble(filename, &content);
-    if (!ok) {
+    Preamble *pre = &ctx.preamble;
+    struct stat st;
+    if (stat(SP_PREAMBLE_PATH, &st) != 0) {
+        fprintf(stderr, "[ERROR] Could not find '%s'\n", SP_PREAMBLE_PATH);
+        return false;
+    }
+    if (pre->source != NULL && pre->mtime == st.st_mtime) return true;
+
+    FILE *fp = fopen(SP_PREAMBLE_PATH, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "[ERROR] Could not open '%s'\n", SP_PREAMBLE_PATH);
         return false;
     }
+    char *source = malloc(st.st_size + 1);
+    SP_ASSERT(source != NULL && "Buy MORE RAM lol!!");
+    size_t n = fread(source, 1, st.st_size, fp);
+    source[n] = '\0';
+    fclose(fp);
 
-    if (ctx.umka == NULL) {
-        ctx.umka = umkaAlloc();
+    int lines = 1;
+    for (size_t i = 0; i < n; i++) {
+        if (source[i] == '\n') lines++;
     }
-    ok = umkaInit(ctx.umka, NULL, content, 1024 * 1024, NULL, 0, NULL, false, false, NULL);
+
+    free(pre->source);
+    pre->source = source;
+    pre->lines = lines;
+    pre->mtime = st.st_mtime;
+    return true;
+}
+
+bool spc_umka_init(Scene *sc, const char *filename)
+{
+    if (ctx.preamble.source == NULL && !spc_load_preamble()) return false;
+
+    char *content = NULL;
+    bool ok = spu_content_w_preamble(sc, filename, &content);
     if (!ok) {
-        spu_print_err();
         return false;
     }
+    return spc_umka_compile(sc, content);
+}
 
-    UmkaFunc fns[] = {
-        (UmkaFunc){.name = "rect", .func = &spuo_rect},
-        (UmkaFunc){.name = "text", .func = &spuo_text},
-        (UmkaFunc){.name = "axes", .func = &spuo_axes},
-        (UmkaFunc){.name = "curve", .func = &spuo_curve},
-        (UmkaFunc){.name = "typst", .func = &spuo_typst},
+bool spc_umka_compile(Scene *sc, const char *content)
+{
+    bool ok = false;
+    int stack_size = ctx.umka_stack_size > 0 ? ctx.umka_stack_size : SP_UMKA_STACK_SIZE;
+    sc->umka = umkaAlloc();
+    // NOTE: Umka reads the modules the script imports itself, relative to the
+    // module that imports them, so it has to know where the script is
+    ok = umkaInit(sc->umka, ctx.filename, content, stack_size, NULL, 0, NULL, false, false, NULL);
+    if (!ok) {
+        spu_print_err(sc);
+        return false;
+    }
+    umkaSetMetadata(sc->umka, sc);
 
-        (UmkaFunc){.name = "fade_in", .func = &spu_fade_in},
-        (UmkaFunc){.name = "fade_out", .func = &spu_fade_out},
-        (UmkaFunc){.name = "move", .func = &spu_move},
-        (UmkaFunc){.name = "wait", .func = &spu_wait},
-        (UmkaFunc){.name = "play", .func = &spu_play},
+    // NOTE: The main module still gets the preamble pasted in after its
+    // imports so scripts can call `rect` and friends unqualified. Other
+    // modules can `import "span.um"` instead, from whichever directory they're
+    // in. Umka only compiles it if someone does.
+    ok = umkaAddModule(sc->umka, SP_PREAMBLE_MODULE, ctx.preamble.source);
+    if (!ok) {
+        spu_print_err(sc);
+        return false;
+    }
 
-        (UmkaFunc){.name = "enable", .func = &spuo_enable},
-    };
-    for (int i = 0; i < SP_LEN(fns); i++) {
-        ok = umkaAddFunc(ctx.umka, fns[i].name, fns[i].func);
+    const UmkaFunc *externs = sc->profile.enabled ? spu__prof_externs : spu__externs;
+    for (int i = 0; i < SP_LEN(spu__externs); i++) {
+        ok = umkaAddFunc(sc->umka, externs[i].name, externs[i].func);
         if (!ok) {
-            spu_print_err();
+            spu_print_err(sc);
             return false;
         }
     }
 
-    ok = umkaCompile(ctx.umka);
+    f64 start = sp_now();
+    ok = umkaCompile(sc->umka);
+    sc->profile.compile_time = sp_now() - start;
+    SP_TRACE_END(start, "umkaCompile");
     if (!ok) {
-        spu_print_err();
+        spu_print_err(sc);
         return false;
     }
     return true;
 }
 
-void spc_renderer_init(RenderMode mode)
+bool spc_renderer_init(RenderMode mode)
 {
-    ctx.pres = (IVector2){ 800, 600 };
-    SetConfigFlags(FLAG_MSAA_4X_HINT);
-    InitWindow(ctx.pres.x, ctx.pres.y, "span");
-    ctx.fps = 60;
-    SetTargetFPS(ctx.fps);
+    // NOTE: A video only needs a GL context to be drawn in, which doesn't take
+    // a display. The preview does need one.
+    bool display = getenv("DISPLAY") != NULL || getenv("WAYLAND_DISPLAY") != NULL;
+    ctx.headless = mode == RM_Output && !display;
+    if (ctx.headless) {
+        if (!headless_start(ctx.vres.x, ctx.vres.y)) {
+            fprintf(stderr, "[ERROR] There's no display and no EGL to render %s without one\n", ctx.filename);
+            return false;
+        }
+    } else {
+        // NOTE: raylib crashes instead of failing when GLFW has no display
+        if (!display) {
+            fprintf(stderr, "[ERROR] There's no display to preview %s on, see --mode output\n", ctx.filename);
+            return false;
+        }
+        SetConfigFlags(FLAG_MSAA_4X_HINT);
+        InitWindow(ctx.pres.x, ctx.pres.y, "span");
+        if (!IsWindowReady()) {
+            fprintf(stderr, "[ERROR] Could not open a window to preview %s in\n", ctx.filename);
+            return false;
+        }
+        SetTargetFPS(ctx.fps);
+    }
 
     switch (mode) {
         case RM_Preview: {
-            ctx.vres = ctx.pres;
+            for (int i = 0; i < HS_COUNT; i++) {
+                ctx.hud.ms[i] = arena_alloc(&arena, SP_HUD_SAMPLES*sizeof(f32));
+                memset(ctx.hud.ms[i], 0, SP_HUD_SAMPLES*sizeof(f32));
+            }
         } break;
 
         case RM_Output: {
-            ctx.vres = (IVector2){ 1600, 1200 };
-            // NOTE: The aspect ratio of the preview window and video have to be the same.
-            f32 p_aspect_ratio = (f32)ctx.pres.x / (f32)ctx.pres.y;
-            f32 v_aspect_ratio = (f32)ctx.vres.x / (f32)ctx.vres.y;
-            SP_ASSERT(p_aspect_ratio == v_aspect_ratio);
-
+            // NOTE: ffmpeg is only started once the range to render is known
+            // to be in the scene, see `spc_init`
             ctx.rtex = LoadRenderTexture(ctx.vres.x, ctx.vres.y);
-            ctx.ffmpeg = ffmpeg_start_rendering_video(
-                "out.mov", (size_t)ctx.vres.x, (size_t)ctx.vres.y, (size_t)ctx.fps);
         } break;
 
         default: {
@@ -110,136 +539,1193 @@ void spc_renderer_init(RenderMode mode)
     }
     ctx.render_mode = mode;
 
+    spr_batch_init(&ctx.rect_batch);
+
     ctx.cam = (Camera2D) {
         .offset = Vector2Scale(spv_itof(ctx.vres), 0.5),
         .target = Vector2Zero(),
         .rotation = 0.0f,
         .zoom = 1.0f,
     };
+    ctx.orig_cam = ctx.cam;
+    return true;
+}
+
+// NOTE: Starts the sequence and builds its first few tasks, the rest is
+// built while it plays.
+bool spc_run_umka(Scene *sc)
+{
+    sc->cam = ctx.orig_cam;
+    return spu_run_sequence(sc) && sps_build_until(sc, 0.0);
 }
 
-void spc_run_umka(void)
+// NOTE: Brings `ctx` up to date with whatever the last step added to the
+// scene. `ctx.state` is the playback state and has to be kept apart from the
+// scene's own `state`, which the sequence keeps modifying as it's built.
+static void spc__stream_sync(Scene *sc)
 {
-    spu_run_sequence();
+    int from = ctx.state.count, to = sc->orig.count;
+    for (int i = from; i < to; i++) {
+        if (sc->store.kind[i] == OK_TYPST) spo_typst_upload(spo_payload(&sc->store, i));
+    }
+    if (to > from) {
+        spo_state_reserve(sc->arena, &ctx.state, to - from);
+        memcpy(ctx.state.pos + from, sc->orig.pos + from, (to - from)*sizeof(*ctx.state.pos));
+        memcpy(ctx.state.color + from, sc->orig.color + from, (to - from)*sizeof(*ctx.state.color));
+        memcpy(ctx.state.enabled + from, sc->orig.enabled + from, (to - from)*sizeof(*ctx.state.enabled));
+        ctx.state.count = to;
+        spc_changed_reserve(sc->arena, ctx.state.capacity);
+    }
+    ctx.scene_arena = sc->arena;
+    ctx.store = sc->store;
+    ctx.orig = sc->orig;
+    ctx.tasks = sc->tasks;
+    // NOTE: The last task is still collecting actions until the next `play`
+    if (!sc->done && ctx.tasks.count > 0) ctx.tasks.count--;
+    ctx.tasks_dropped = sc->tasks_dropped;
+    ctx.time_dropped = sc->time_dropped;
+    ctx.id_counter = sc->id_counter;
+    ctx.handles = sc->handles;
+    ctx.updaters = sc->updaters;
+    ctx.typst_compiled = sc->typst_compiled;
+}
+
+static void spc__stream_step(void)
+{
+    Scene *sc = ctx.stream;
+    int count = ctx.state.count;
+
+    if (!sps_step(sc)) {
+        printf("Stopped building %s, the rest of the sequence is skipped\n", ctx.filename);
+        sc->done = true;
+    }
+    spc__stream_sync(sc);
+    if (ctx.state.count != count) ctx.grid.stale = true;
+
+    if (sc->done) {
+        // NOTE: Only updaters run on this instance from now on
+        umkaSetMetadata(ctx.umka, NULL);
+        free(sc);
+        ctx.stream = NULL;
+        spc_cache_write();
+    }
+}
+
+// NOTE: Makes sure there are `SP_STREAM_AHEAD` tasks built past the current one
+static void spc__stream_ahead(void)
+{
+    while (ctx.stream != NULL && ctx.current + SP_STREAM_AHEAD >= ctx.tasks.count) {
+        spc__stream_step();
+    }
+}
+
+// NOTE: Hands a built scene over to `ctx`. This has to happen on the main
+// thread, since it's where the GPU resources get created.
+void spc_swap_scene(Scene *sc)
+{
+    spc_bake_close();
+    spc_clear_for_recomp(sc->prev_kept, sc->prev.count);
+    if (ctx.cache_map != NULL) munmap(ctx.cache_map, ctx.cache_map_size);
+    ctx.cache_map = sc->map;
+    ctx.cache_map_size = sc->map_size;
+    ctx.cache_key = sc->cache_key;
+    ctx.bake_key = sc->bake_key;
+    if (sc->map != NULL) {
+        // NOTE: The pixels are in the mapping, they must not go through
+        // `spo_typst_upload`, which frees the image
+        for (int i = 0; i < sc->store.typsts.count; i++) {
+            Typst *typ = &sc->store.typsts.items[i];
+            if (typ->image.data == NULL) continue;
+            typ->texture = LoadTextureFromImage(typ->image);
+            SetTextureFilter(typ->texture, TEXTURE_FILTER_BILINEAR);
+            typ->image = (Image){0};
+        }
+    }
+    // NOTE: The previous objects are about to be recycled, so whatever gets
+    // built from here on can't take anything over from them.
+    sc->prev = (ObjStore){0};
+    sc->prev_index = (ObjHashList){0};
+    sc->prev_kept = NULL;
+
+    free(ctx.stream);
+    ctx.stream = NULL;
+    if (ctx.umka != NULL) umkaFree(ctx.umka);
+    spc__recycle_arena(ctx.scene_arena);
+    // NOTE: The grid's per-object arrays lived in the old generation
+    ctx.grid.capacity = 0;
+
+    ctx.umka = sc->umka;
+    ctx.state = (ObjState){0};
+    ctx.changed = (ChangedSet){0};
+    ctx.bake = (UpdaterBake){0};
+    ctx.lines = sc->lines;
+    spc__stream_sync(sc);
+    if (sc->done) {
+        if (ctx.umka != NULL) umkaSetMetadata(ctx.umka, NULL);
+        free(sc);
+        spc_cache_write();
+    } else {
+        ctx.stream = sc;
+    }
+
     spc_reset();
 }
 
+static void *spc__reload_worker(void *arg)
+{
+    Reload *rl = arg;
+    rl->ok = spc_umka_init(rl->scene, ctx.filename) && spc_run_umka(rl->scene)
+        && sps_build_until(rl->scene, rl->resume_at);
+    rl->built_at = GetTime();
+    atomic_store(&rl->done, true);
+    return NULL;
+}
+
+static void *spc__reload_thread(void *arg)
+{
+    sp_trace_thread_begin("reload");
+    spc__reload_worker(arg);
+    sp_trace_thread_end();
+    return NULL;
+}
+
+void spc_request_reload(void)
+{
+    ctx.reload.pending = true;
+    ctx.reload.last_event = 0.0;
+}
+
+void spc_poll_reload(void)
+{
+    Reload *rl = &ctx.reload;
+    if (rl->watcher != NULL && watch_poll(rl->watcher)) {
+        rl->pending = true;
+        rl->last_event = GetTime();
+    }
+
+    if (rl->running) {
+        if (!atomic_load(&rl->done)) return;
+
+        if (rl->threaded) pthread_join(rl->thread, NULL);
+        rl->running = false;
+        if (rl->ok) {
+            int reused = rl->scene->reused;
+            f64 time = spc_time();
+            bool paused = ctx.paused;
+            spc_swap_scene(rl->scene);
+            spc_seek(time);
+            ctx.paused = ctx.paused || paused;
+
+            f64 now = GetTime();
+            printf("Reloaded %s in %.1f ms (build %.1f ms, swap %.1f ms), reused %d of %d objects\n",
+                ctx.filename,
+                (now - rl->started_at) * 1000.0,
+                (rl->built_at - rl->started_at) * 1000.0,
+                (now - rl->built_at) * 1000.0,
+                reused, ctx.store.count);
+        } else {
+            sps_free(rl->scene);
+            printf("Could not reload %s, the previous version is kept\n", ctx.filename);
+        }
+        rl->scene = NULL;
+        ctx.dirty = true;
+        spc__watch_sources();
+    }
+
+    if (rl->pending && GetTime() - rl->last_event >= SP_RELOAD_DEBOUNCE) {
+        rl->pending = false;
+        // NOTE: No build is running at this point, so the preamble is safe
+        // to replace if it was the file that changed.
+        if (!spc_load_preamble()) return;
+        rl->scene = spc_new_scene();
+        rl->scene->prev = ctx.store;
+        // NOTE: Everything up to the playhead is needed right after the swap
+        // anyway, so it's built on the reload thread as well
+        rl->resume_at = spc_time();
+        atomic_store(&rl->done, false);
+        rl->started_at = GetTime();
+        rl->running = true;
+        rl->threaded = pthread_create(&rl->thread, NULL, spc__reload_thread, rl) == 0;
+        // NOTE: Building on the main thread still works, it just blocks the
+        // preview until it's done. The next poll swaps it in all the same.
+        if (!rl->threaded) spc__reload_worker(rl);
+    }
+}
+
+// NOTE: A fully built scene is cached in `SP_CACHE_DIR/<key>.scene`, where the
+// key covers the script, the preamble, the resolutions and the build of span.
+// The file is the object store, the state the objects start in and the tasks
+// as they are in memory, followed by everything they point to. Pointers are
+// stored as offsets into the file and get patched in place after it's mapped
+// privately, so only the pages with pointers in them get copied. The
+// components, points, actions and the pixels of formulas are used straight
+// from the page cache.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+    int32_t obj_count, task_count;
+    uint64_t store_off, orig_off, tasks_off;
+} SceneCacheHeader;
+
+#define SP_CACHE_MAGIC "SPANSCN"
+#define SP_CACHE_PTR(off) ((void *)(uintptr_t)(off))
+
+static void spc__cache_path(char *path, size_t size, uint64_t key)
+{
+    snprintf(path, size, SP_CACHE_DIR"/%016llx.scene", (unsigned long long)key);
+}
+
+static uint64_t spc__cache_put(Nob_String_Builder *sb, const void *data, size_t size)
+{
+    while (sb->count % 16 != 0) nob_da_append(sb, '\0');
+    uint64_t off = sb->count;
+    nob_sb_append_buf(sb, data, size);
+    return off;
+}
+
+// NOTE: Offset 0 is the header, so empty arrays are stored as NULL
+static uint64_t spc__cache_arr(Nob_String_Builder *sb, const void *items, int count, size_t size)
+{
+    return count > 0 ? spc__cache_put(sb, items, count*size) : 0;
+}
+
+// NOTE: Scenes with updaters still need Umka at runtime, and ones that came
+// from the cache or are still streaming have nothing to write. Neither do
+// ones whose first tasks were already dropped.
+bool spc_cache_write(void)
+{
+    if (ctx.stream != NULL || ctx.cache_map != NULL || ctx.updaters.count > 0) return false;
+    if (ctx.tasks_dropped > 0) return false;
+
+    char path[256], tmp_path[272];
+    spc__cache_path(path, sizeof(path), ctx.cache_key);
+    if (access(path, F_OK) == 0) return true;
+    if (mkdir(SP_CACHE_DIR, 0755) != 0 && errno != EEXIST) return false;
+
+    Nob_String_Builder sb = {0};
+    SceneCacheHeader h = {
+        .magic = SP_CACHE_MAGIC,
+        .version = SP_CACHE_VERSION,
+        .key = ctx.cache_key,
+        .obj_count = ctx.store.count,
+        .task_count = ctx.tasks.count,
+    };
+    spc__cache_put(&sb, &h, sizeof(h));
+
+    ObjStore store = ctx.store;
+    int n = store.count;
+    store.kind = SP_CACHE_PTR(spc__cache_arr(&sb, store.kind, n, sizeof(*store.kind)));
+    store.payload = SP_CACHE_PTR(spc__cache_arr(&sb, store.payload, n, sizeof(*store.payload)));
+    store.capacity = n;
+
+    store.rects.items = SP_CACHE_PTR(spc__cache_arr(&sb, store.rects.items, store.rects.count, sizeof(Rect)));
+    store.rects.capacity = store.rects.count;
+    store.axes.items = SP_CACHE_PTR(spc__cache_arr(&sb, store.axes.items, store.axes.count, sizeof(Axes)));
+    store.axes.capacity = store.axes.count;
+
+    uint64_t texts_off = spc__cache_arr(&sb, store.texts.items, store.texts.count, sizeof(Text));
+    for (int i = 0; i < store.texts.count; i++) {
+        Text t = ctx.store.texts.items[i];
+        t.str = SP_CACHE_PTR(spc__cache_put(&sb, t.str, strlen(t.str) + 1));
+        memcpy(sb.items + texts_off + i*sizeof(Text), &t, sizeof(t));
+    }
+    store.texts.items = SP_CACHE_PTR(texts_off);
+    store.texts.capacity = store.texts.count;
+
+    uint64_t curves_off = spc__cache_arr(&sb, store.curves.items, store.curves.count, sizeof(Curve));
+    for (int i = 0; i < store.curves.count; i++) {
+        Curve c = ctx.store.curves.items[i];
+        c.pts.items = SP_CACHE_PTR(spc__cache_arr(&sb, c.pts.items, c.pts.count, sizeof(Vector2)));
+        c.pts.capacity = c.pts.count;
+        c.strip.items = SP_CACHE_PTR(spc__cache_arr(&sb, c.strip.items, c.strip.count, sizeof(Vector2)));
+        c.strip.capacity = c.strip.count;
+        memcpy(sb.items + curves_off + i*sizeof(Curve), &c, sizeof(c));
+    }
+    store.curves.items = SP_CACHE_PTR(curves_off);
+    store.curves.capacity = store.curves.count;
+
+    uint64_t typsts_off = spc__cache_arr(&sb, store.typsts.items, store.typsts.count, sizeof(Typst));
+    for (int i = 0; i < store.typsts.count; i++) {
+        Typst typ = ctx.store.typsts.items[i];
+        typ.text = SP_CACHE_PTR(spc__cache_put(&sb, typ.text, strlen(typ.text) + 1));
+        // NOTE: The image was freed after it got uploaded, so the pixels are
+        // read back from the texture
+        if (IsTextureValid(typ.texture)) {
+            Image img = LoadImageFromTexture(typ.texture);
+            int size = GetPixelDataSize(img.width, img.height, img.format);
+            typ.image = img;
+            typ.image.data = SP_CACHE_PTR(spc__cache_put(&sb, img.data, size));
+            UnloadImage(img);
+        }
+        typ.texture = (Texture){0};
+        memcpy(sb.items + typsts_off + i*sizeof(Typst), &typ, sizeof(typ));
+    }
+    store.typsts.items = SP_CACHE_PTR(typsts_off);
+    store.typsts.capacity = store.typsts.count;
+    h.store_off = spc__cache_put(&sb, &store, sizeof(store));
+
+    ObjState orig = ctx.orig;
+    orig.pos = SP_CACHE_PTR(spc__cache_arr(&sb, orig.pos, n, sizeof(*orig.pos)));
+    orig.color = SP_CACHE_PTR(spc__cache_arr(&sb, orig.color, n, sizeof(*orig.color)));
+    orig.enabled = SP_CACHE_PTR(spc__cache_arr(&sb, orig.enabled, n, sizeof(*orig.enabled)));
+    orig.capacity = n;
+    h.orig_off = spc__cache_put(&sb, &orig, sizeof(orig));
+
+    h.tasks_off = spc__cache_arr(&sb, ctx.tasks.items, ctx.tasks.count, sizeof(Task));
+    for (int i = 0; i < ctx.tasks.count; i++) {
+        Task t = ctx.tasks.items[i];
+        t.actions.items = SP_CACHE_PTR(spc__cache_arr(&sb, t.actions.items, t.actions.count, sizeof(Action)));
+        t.actions.capacity = t.actions.count;
+        memcpy(sb.items + h.tasks_off + i*sizeof(Task), &t, sizeof(t));
+    }
+
+    h.size = sb.count;
+    memcpy(sb.items, &h, sizeof(h));
+
+    // NOTE: Written under another name first, so a reader never maps half
+    // of a file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    bool ok = nob_write_entire_file(tmp_path, sb.items, sb.count) && rename(tmp_path, path) == 0;
+    nob_sb_free(sb);
+    if (!ok) {
+        TraceLog(LOG_WARNING, "SPAN: Could not write the scene cache to %s", path);
+    }
+    return ok;
+}
+
+// NOTE: Turns the offset in `ptr` back into a pointer to `count` items of
+// `size` bytes, which all have to be inside of the file
+static void *spc__cache_fix(char *base, uint64_t size, void *ptr, int count, size_t item_size, bool *ok)
+{
+    uint64_t off = (uintptr_t)ptr;
+    if (off == 0) return NULL;
+    if (count < 0 || off >= size || (size - off) / item_size < (uint64_t)count) *ok = false;
+    return *ok ? base + off : NULL;
+}
+
+// NOTE: Camera actions and waits are on the scene, the rest name one of the
+// `count` objects
+static bool spc__cache_action_ok(Action a, int count)
+{
+    if (a.kind > AK_Disable) return false;
+    bool scene = a.kind == AK_Wait || a.kind == AK_CamMove || a.kind == AK_CamZoom || a.kind == AK_CamRotate;
+    return scene || a.obj_id < (Id)count;
+}
+
+// NOTE: Returns NULL if there's no cache for `key` or it can't be used, in
+// which case the script has to be built
+Scene *spc_cache_load(uint64_t key)
+{
+    char path[256];
+    spc__cache_path(path, sizeof(path), key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SceneCacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    char *base = map;
+    SceneCacheHeader *h = map;
+    bool ok = memcmp(h->magic, SP_CACHE_MAGIC, sizeof(SP_CACHE_MAGIC)) == 0
+        && h->version == SP_CACHE_VERSION && h->key == key && h->size == (uint64_t)st.st_size;
+
+    ObjStore *store = spc__cache_fix(base, h->size, SP_CACHE_PTR(h->store_off), 1, sizeof(ObjStore), &ok);
+    ObjState *orig = spc__cache_fix(base, h->size, SP_CACHE_PTR(h->orig_off), 1, sizeof(ObjState), &ok);
+    Task *tasks = spc__cache_fix(base, h->size, SP_CACHE_PTR(h->tasks_off), h->task_count, sizeof(Task), &ok);
+    ok = ok && store != NULL && orig != NULL
+        && store->count == h->obj_count && orig->count == h->obj_count;
+
+    if (ok) {
+        int n = h->obj_count;
+        store->kind = spc__cache_fix(base, h->size, store->kind, n, sizeof(*store->kind), &ok);
+        store->payload = spc__cache_fix(base, h->size, store->payload, n, sizeof(*store->payload), &ok);
+        store->rects.items = spc__cache_fix(base, h->size, store->rects.items, store->rects.count, sizeof(Rect), &ok);
+        store->texts.items = spc__cache_fix(base, h->size, store->texts.items, store->texts.count, sizeof(Text), &ok);
+        store->axes.items = spc__cache_fix(base, h->size, store->axes.items, store->axes.count, sizeof(Axes), &ok);
+        store->curves.items = spc__cache_fix(base, h->size, store->curves.items, store->curves.count, sizeof(Curve), &ok);
+        store->typsts.items = spc__cache_fix(base, h->size, store->typsts.items, store->typsts.count, sizeof(Typst), &ok);
+        orig->pos = spc__cache_fix(base, h->size, orig->pos, n, sizeof(*orig->pos), &ok);
+        orig->color = spc__cache_fix(base, h->size, orig->color, n, sizeof(*orig->color), &ok);
+        orig->enabled = spc__cache_fix(base, h->size, orig->enabled, n, sizeof(*orig->enabled), &ok);
+    }
+
+    for (int i = 0; ok && i < h->obj_count; i++) {
+        ok = store->kind[i] <= OK_TYPST && store->payload[i] >= 0
+            && store->payload[i] < spo_kind_count(store, store->kind[i]);
+    }
+    for (int i = 0; ok && i < store->texts.count; i++) {
+        Text *t = &store->texts.items[i];
+        t->str = spc__cache_fix(base, h->size, (void *)t->str, 1, 1, &ok);
+    }
+    for (int i = 0; ok && i < store->typsts.count; i++) {
+        Typst *typ = &store->typsts.items[i];
+        typ->text = spc__cache_fix(base, h->size, (void *)typ->text, 1, 1, &ok);
+        int size = GetPixelDataSize(typ->image.width, typ->image.height, typ->image.format);
+        typ->image.data = spc__cache_fix(base, h->size, typ->image.data, size, 1, &ok);
+    }
+    for (int i = 0; ok && i < store->curves.count; i++) {
+        Curve *c = &store->curves.items[i];
+        c->pts.items = spc__cache_fix(base, h->size, c->pts.items, c->pts.count, sizeof(Vector2), &ok);
+        c->strip.items = spc__cache_fix(base, h->size, c->strip.items, c->strip.count, sizeof(Vector2), &ok);
+    }
+    for (int i = 0; ok && i < h->task_count; i++) {
+        ActionList *al = &tasks[i].actions;
+        al->items = spc__cache_fix(base, h->size, al->items, al->count, sizeof(Action), &ok);
+        ok = ok && tasks[i].events >= 0 && tasks[i].events <= al->count;
+        for (int j = 0; ok && j < al->count; j++) ok = spc__cache_action_ok(al->items[j], h->obj_count);
+    }
+
+    if (!ok) {
+        TraceLog(LOG_WARNING, "SPAN: Ignoring the scene cache in %s", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    Scene *sc = spc_new_scene();
+    sc->store = *store;
+    sc->orig = *orig;
+    sc->tasks = (TaskList){ .items = tasks, .count = h->task_count, .capacity = h->task_count };
+    sc->id_counter = h->obj_count;
+    sc->lines.preamble_lines = ctx.preamble.lines;
+    sc->cache_key = key;
+    sc->map = map;
+    sc->map_size = st.st_size;
+    sc->done = true;
+    TraceLog(LOG_INFO, "SPAN: Loaded the scene from %s", path);
+    return sc;
+}
+
+// NOTE: What the updaters wrote is kept in `SP_CACHE_DIR/<key>.bake`. The key
+// is the scene's, with the frame rate the frames are numbered at instead of the
+// resolutions. What the updaters write doesn't depend on those, so a render
+// replays the frames the preview baked and the other way around. The file is
+// the header, the writes and the frames, which index into the writes.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+    int32_t write_count, frame_count;
+    uint64_t writes_off, frames_off;
+} BakeCacheHeader;
+
+#define SP_BAKE_MAGIC "SPANBKE"
+
+static void spc__bake_path(char *path, size_t size, uint64_t key)
+{
+    snprintf(path, size, SP_CACHE_DIR"/%016llx.bake", (unsigned long long)key);
+}
+
+// NOTE: Called on the first frame updaters run, since a scene that's still
+// streaming may only add them later. A bake that can't be used is ignored,
+// the frames are then evaluated and baked again.
+void spc_bake_load(void)
+{
+    UpdaterBake *bake = &ctx.bake;
+    bake->loaded = true;
+
+    char path[256];
+    spc__bake_path(path, sizeof(path), ctx.bake_key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BakeCacheHeader)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    char *base = map;
+    BakeCacheHeader *h = map;
+    bool ok = memcmp(h->magic, SP_BAKE_MAGIC, sizeof(SP_BAKE_MAGIC)) == 0
+        && h->version == SP_CACHE_VERSION && h->key == ctx.bake_key && h->size == (uint64_t)st.st_size;
+    UpdaterWrite *writes = spc__cache_fix(base, h->size, SP_CACHE_PTR(h->writes_off), h->write_count, sizeof(UpdaterWrite), &ok);
+    BakedFrame *frames = spc__cache_fix(base, h->size, SP_CACHE_PTR(h->frames_off), h->frame_count, sizeof(BakedFrame), &ok);
+    for (int i = 0; ok && i < h->frame_count; i++) {
+        BakedFrame f = frames[i];
+        ok = f.start >= 0 && f.count >= 0 && f.count <= h->write_count - f.start;
+    }
+    if (!ok) {
+        TraceLog(LOG_WARNING, "SPAN: Ignoring the updaters baked in %s", path);
+        munmap(map, st.st_size);
+        return;
+    }
+
+    bake->writes = (UpdaterWriteList){ .items = writes, .count = h->write_count, .capacity = h->write_count };
+    bake->frames = (BakedFrameList){ .items = frames, .count = h->frame_count, .capacity = h->frame_count };
+    bake->map = map;
+    bake->map_size = st.st_size;
+    TraceLog(LOG_INFO, "SPAN: Replaying %d frames of updaters from %s", h->frame_count, path);
+}
+
+// NOTE: Only writes when frames were baked since the file was read, the ones
+// that came from it are written again along with them
+bool spc_bake_write(void)
+{
+    UpdaterBake *bake = &ctx.bake;
+    if (!bake->dirty) return true;
+
+    char path[256], tmp_path[272];
+    spc__bake_path(path, sizeof(path), ctx.bake_key);
+    if (mkdir(SP_CACHE_DIR, 0755) != 0 && errno != EEXIST) return false;
+
+    Nob_String_Builder sb = {0};
+    BakeCacheHeader h = {
+        .magic = SP_BAKE_MAGIC,
+        .version = SP_CACHE_VERSION,
+        .key = ctx.bake_key,
+        .write_count = bake->writes.count,
+        .frame_count = bake->frames.count,
+    };
+    spc__cache_put(&sb, &h, sizeof(h));
+    h.writes_off = spc__cache_arr(&sb, bake->writes.items, bake->writes.count, sizeof(UpdaterWrite));
+    h.frames_off = spc__cache_arr(&sb, bake->frames.items, bake->frames.count, sizeof(BakedFrame));
+    h.size = sb.count;
+    memcpy(sb.items, &h, sizeof(h));
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    bool ok = nob_write_entire_file(tmp_path, sb.items, sb.count) && rename(tmp_path, path) == 0;
+    nob_sb_free(sb);
+    if (!ok) {
+        TraceLog(LOG_WARNING, "SPAN: Could not write the baked updaters to %s", path);
+    }
+    return ok;
+}
+
+// NOTE: The lists live in the scene's arena or the mapping, so this has to
+// happen before either goes away
+void spc_bake_close(void)
+{
+    spc_bake_write();
+    if (ctx.bake.map != NULL) munmap(ctx.bake.map, ctx.bake.map_size);
+    ctx.bake = (UpdaterBake){0};
+}
 
 void spc_deinit(void)
 {
-    umkaFree(ctx.umka);
+    Reload *rl = &ctx.reload;
+    if (rl->running) {
+        if (rl->threaded) pthread_join(rl->thread, NULL);
+        sps_free(rl->scene);
+    }
+    watch_stop(rl->watcher);
+
+    spc_clear_for_recomp(NULL, 0);
+    free(ctx.stream);
+    if (ctx.umka != NULL) umkaFree(ctx.umka);
+    if (ctx.cache_map != NULL) munmap(ctx.cache_map, ctx.cache_map_size);
+    spc_bake_close();
 
     if (ctx.render_mode == RM_Output) {
-        ffmpeg_end_rendering(ctx.ffmpeg, false);
+        if (ctx.ffmpeg != NULL) ffmpeg_end_rendering(ctx.ffmpeg, false);
         UnloadRenderTexture(ctx.rtex);
     }
-    CloseWindow();
-
+    spr_batch_deinit(&ctx.rect_batch);
+    if (IsRenderTextureValid(ctx.dynres.target)) UnloadRenderTexture(ctx.dynres.target);
+    spc__renderer_close();
+
+    // NOTE: Goes through the spare, which is freed right after
+    spc__recycle_arena(ctx.scene_arena);
+    ctx.scene_arena = NULL;
+    arena_free(&ctx.task_arenas[0]);
+    arena_free(&ctx.task_arenas[1]);
+    if (ctx.spare_arena != NULL) {
+        arena_free(ctx.spare_arena);
+        free(ctx.spare_arena);
+        ctx.spare_arena = NULL;
+    }
     arena_free(&arena);
+    if (ctx.profile_trace != NULL) sp_trace_write(ctx.profile_trace);
+    free(ctx.preamble.source);
+    for (int i = 0; i < ctx.sources.count; i++) {
+        Source *src = &ctx.sources.items[i];
+        if (src->data != NULL && src->size > 0) munmap((void *)src->data, src->size);
+    }
+    arena_free(&ctx.source_arena);
+}
+
+// NOTE: `ids` never holds an object twice, so with room for every object it
+// never has to grow while playing
+void spc_changed_reserve(Arena *a, int n)
+{
+    ChangedSet *ch = &ctx.changed;
+    if (n <= ch->capacity) return;
+
+    ch->marked = arena_realloc(a, ch->marked, ch->capacity*sizeof(*ch->marked), n*sizeof(*ch->marked));
+    memset(ch->marked + ch->capacity, 0, (n - ch->capacity)*sizeof(*ch->marked));
+    ch->ids.items = arena_realloc(a, ch->ids.items, ch->capacity*sizeof(Id), n*sizeof(Id));
+    ch->ids.capacity = n;
+    ch->capacity = n;
+}
+
+static void spc__changed_mark(Id id, ChangeKind kind)
+{
+    ChangedSet *ch = &ctx.changed;
+    uint8_t *m = &ch->marked[id];
+    if (*m == 0) ch->ids.items[ch->ids.count++] = id;
+    if ((kind & CH_Moved) && !(*m & CH_Moved)) ch->moved++;
+    *m |= kind;
+}
+
+// NOTE: `start` is whether this is the first time the task is applied since
+// it started, which is the only time its events have to be applied
+void spc_apply_task(const Task *task, f32 factor, bool start)
+{
+    ActionList al = task->actions;
+    int from = start ? 0 : task->events;
+    // NOTE: Moving, showing or hiding a large part of the scene one object at
+    // a time costs more than building the grid again once they're all done
+    int moves = 0;
+    for (int i = from; i < al.count; i++) {
+        ActionKind kind = al.items[i].kind;
+        moves += kind == AK_Move || kind == AK_Enable || kind == AK_Disable;
+    }
+    if (moves > SP_GRID_MIN_REBUILD && moves > ctx.grid.count / SP_GRID_REBUILD_DIV) ctx.grid.stale = true;
+
+    for (int i = from; i < al.count; i++) {
+        Action a = al.items[i];
+
+        switch (a.kind) {
+            case AK_Enable: {
+                SP_ASSERT(a.obj_id < (Id)ctx.state.count);
+                spc__changed_mark(a.obj_id, CH_State | CH_Moved);
+                ctx.state.enabled[a.obj_id] = true;
+                spg_update(&ctx.grid, a.obj_id);
+            } break;
+
+            case AK_Disable: {
+                SP_ASSERT(a.obj_id < (Id)ctx.state.count);
+                spc__changed_mark(a.obj_id, CH_State | CH_Moved);
+                ctx.state.enabled[a.obj_id] = false;
+                spg_update(&ctx.grid, a.obj_id);
+            } break;
+
+            case AK_Wait: break;
+
+            case AK_Move: {
+                SP_ASSERT(a.obj_id < (Id)ctx.state.count);
+                SP_ASSERT(ctx.state.enabled[a.obj_id]);
+                spc__changed_mark(a.obj_id, CH_State | CH_Moved);
+                DVector2 *pos = spo_pos(&ctx.state, &ctx.store, a.obj_id);
+
+                spa_interp(a, (void*)&pos, factor);
+                spg_update(&ctx.grid, a.obj_id);
+            } break;
+
+            case AK_Fade: {
+                SP_ASSERT(a.obj_id < (Id)ctx.state.count);
+                SP_ASSERT(ctx.state.enabled[a.obj_id]);
+                spc__changed_mark(a.obj_id, CH_State);
+                Color *color = spo_color(&ctx.state, &ctx.store, a.obj_id);
+                bool was_clear = color->a == 0;
+
+                spa_interp(a, (void*)&color, factor);
+                // NOTE: Fully transparent objects are left out of the grid
+                if ((color->a == 0) != was_clear) {
+                    spc__changed_mark(a.obj_id, CH_Moved);
+                    spg_update(&ctx.grid, a.obj_id);
+                }
+            } break;
+
+            case AK_CamMove: {
+                Vector2 *target = &ctx.cam.target;
+                spa_interp(a, (void*)&target, factor);
+            } break;
+
+            case AK_CamZoom: {
+                f32 *zoom = &ctx.cam.zoom;
+                spa_interp(a, (void*)&zoom, factor);
+            } break;
+
+            case AK_CamRotate: {
+                f32 *rotation = &ctx.cam.rotation;
+                spa_interp(a, (void*)&rotation, factor);
+            } break;
+
+            default: {
+                SP_UNREACHABLEF("Unknown kind: %d", a.kind);
+            } break;
+        }
+    }
+}
+
+// NOTE: Only the preview has a HUD to record into
+static void spc__hud_record(HudStage stage)
+{
+    Hud *hud = &ctx.hud;
+    if (hud->ms[stage] == NULL) return;
+    hud->ms[stage][hud->head] = (f32)(sp_trace_last() * 1000.0);
+}
+
+// NOTE: See `ctx.forward_only`. Once `SP_TASK_WINDOW` tasks have been
+// played, the ones that are left are copied to the other task arena and the
+// played ones are dropped. The arena they were in is reset the next time.
+static void spc__drop_played_tasks(void)
+{
+    if (!ctx.forward_only || ctx.current < SP_TASK_WINDOW) return;
+
+    // NOTE: A scene that's still streaming also has the task that's being
+    // built, which `ctx.tasks` leaves out
+    Scene *sc = ctx.stream;
+    const TaskList *from = sc != NULL ? &sc->tasks : &ctx.tasks;
+    Arena *to = &ctx.task_arenas[ctx.task_flip];
+    ctx.task_flip ^= 1;
+    arena_reset(to);
+
+    // NOTE: Summed in the same order as `spc_time` does, so that the times
+    // come out the same to the last bit
+    TaskList kept = {0};
+    SP_DA_RESERVE(to, &kept, from->count - ctx.current);
+    f64 time_dropped = ctx.time_dropped;
+    for (int i = 0; i < from->count; i++) {
+        Task task = from->items[i];
+        if (i < ctx.current) {
+            time_dropped += task.duration;
+            continue;
+        }
+        task.actions.items = arena_memdup(to, task.actions.items, task.actions.count*sizeof(Action));
+        task.actions.capacity = task.actions.count;
+        kept.items[kept.count++] = task;
+    }
+
+    int tasks_dropped = ctx.tasks_dropped + ctx.current;
+    ctx.current = 0;
+    if (sc != NULL) {
+        sc->tasks = kept;
+        sc->task_arena = to;
+        sc->tasks_dropped = tasks_dropped;
+        sc->time_dropped = time_dropped;
+        spc__stream_sync(sc);
+    } else {
+        ctx.tasks = kept;
+        ctx.tasks_dropped = tasks_dropped;
+        ctx.time_dropped = time_dropped;
+    }
 }
 
-void spc_update(f32 dt)
+void spc_update(f64 dt)
 {
+    SP_TRACE_BEGIN(start);
+    spc__stream_ahead();
+    // NOTE: Tasks that ended since the last frame are finished and the time
+    // past their end carries into the next one. Frames stay at multiples of
+    // `dt` from the start, where a render that seeked there has them too.
+    while (ctx.current < ctx.tasks.count && ctx.t > ctx.tasks.items[ctx.current].duration) {
+        Task task = ctx.tasks.items[ctx.current];
+        spc_apply_task(&task, 1.0f, !ctx.started);
+        ctx.t -= task.duration;
+        ctx.started = false;
+        ctx.current++;
+        spc__drop_played_tasks();
+        spc__stream_ahead();
+    }
+
     if (ctx.current < ctx.tasks.count) {
         Task task = ctx.tasks.items[ctx.current];
-        float factor = sp_easing(ctx.t, task.duration);
-
-        if (ctx.t <= task.duration) {
-            ActionList al = task.actions;
-            for (int i = 0; i < al.count; i++) {
-                Action a = al.items[i];
-
-                switch (a.kind) {
-                    case AK_Enable: {
-                        Obj *obj = NULL;
-                        SP_ASSERT(spc_get_obj(a.obj_id, &obj));
-                        obj->enabled = true;
-                    } break;
-
-                    case AK_Wait: break;
-
-                    case AK_Move: {
-                        Obj *obj = {0};
-                        DVector2 *pos = NULL;
-                        SP_ASSERT(spc_get_obj(a.obj_id, &obj));
-                        SP_ASSERT(obj->enabled);
-                        spo_get_pos(obj, &pos);
-                        SP_ASSERT(pos != NULL);
-
-                        spa_interp(a, (void*)&pos, factor);
-                    } break;
-
-                    case AK_Fade: {
-                        Obj *obj = {0};
-                        Color *color = NULL;
-                        SP_ASSERT(spc_get_obj(a.obj_id, &obj));
-                        SP_ASSERT(obj->enabled);
-                        spo_get_color(obj, &color);
-                        SP_ASSERT(color != NULL);
-
-                        spa_interp(a, (void*)&color, factor);
-                    } break;
-
-                    default: {
-                        SP_UNREACHABLEF("Unknown kind: %d", a.kind);
-                    } break;
-                }
-            }
+        spc_apply_task(&task, sp_easing(ctx.t, task.duration), !ctx.started);
+        ctx.started = true;
+        spc_run_updaters(spc_time());
+        ctx.t += dt;
+    } else {
+        ctx.paused = true;
+    }
+    SP_TRACE_END(start, "spc_update");
+    spc__hud_record(HS_Update);
+}
 
-            ctx.t += dt;
-        } else {
-            ctx.current++;
-            if (ctx.current < ctx.tasks.count) {
-                ctx.t = 0.0f;
-            } else {
-                ctx.paused = true;
-            }
+f64 spc_time(void)
+{
+    f64 time = ctx.time_dropped;
+    for (int i = 0; i < ctx.current && i < ctx.tasks.count; i++) {
+        time += ctx.tasks.items[i].duration;
+    }
+    return time + ctx.t;
+}
+
+// NOTE: Builds the tasks up to the one `point` names, or up to the time it
+// names. Fails when the scene ends before that, its very end is still in it.
+bool spc_time_of(TimePoint point, f64 *time)
+{
+    f64 start = ctx.time_dropped;
+    for (int i = 0;; i++) {
+        while (ctx.stream != NULL && ctx.tasks.count <= i) spc__stream_step();
+        if (point.task && ctx.tasks_dropped + i >= point.value) break;
+        if (!point.task && point.value <= start) break;
+        if (i >= ctx.tasks.count) return false;
+        start += ctx.tasks.items[i].duration;
+    }
+    *time = point.task ? start : point.value;
+    return true;
+}
+
+void spc_seek(f64 time)
+{
+    spc_reset();
+
+    // NOTE: Tasks that end before `time` only need their final state, so each
+    // of them is applied once instead of being played through frame by frame.
+    spc__stream_ahead();
+    while (ctx.current < ctx.tasks.count) {
+        const Task *task = &ctx.tasks.items[ctx.current];
+        if (time <= task->duration) break;
+
+        spc_apply_task(task, 1.0f, true);
+        time -= task->duration;
+        ctx.current++;
+        spc__stream_ahead();
+    }
+
+    if (ctx.current < ctx.tasks.count) {
+        const Task *task = &ctx.tasks.items[ctx.current];
+        ctx.t = time;
+        ctx.started = ctx.t > 0.0;
+        if (ctx.started) spc_apply_task(task, sp_easing(ctx.t, task->duration), true);
+    } else {
+        ctx.paused = true;
+    }
+    spc_run_updaters(spc_time());
+    ctx.dirty = true;
+}
+
+static void spc__apply_write(const UpdaterWrite *w)
+{
+    if (w->obj_id >= (Id)ctx.state.count) return;
+
+    if (w->is_color) {
+        spc__changed_mark(w->obj_id, CH_State);
+        Color *color = spo_color(&ctx.state, &ctx.store, w->obj_id);
+        bool was_clear = color->a == 0;
+        *color = w->as.color;
+        if ((color->a == 0) != was_clear) {
+            spc__changed_mark(w->obj_id, CH_Moved);
+            spg_update(&ctx.grid, w->obj_id);
+        }
+    } else {
+        spc__changed_mark(w->obj_id, CH_State | CH_Moved);
+        *spo_pos(&ctx.state, &ctx.store, w->obj_id) = w->as.pos;
+        spg_update(&ctx.grid, w->obj_id);
+    }
+}
+
+// NOTE: Updaters are evaluated at frame boundaries, so that every frame has a
+// single result that can be baked and replayed.
+void spc_run_updaters(f64 time)
+{
+    if (ctx.updaters.count == 0) return;
+
+    UpdaterBake *bake = &ctx.bake;
+    if (!bake->loaded) spc_bake_load();
+    int frame = (int)(time * ctx.fps + 0.5);
+    if (frame < bake->frames.count && bake->frames.items[frame].baked) {
+        BakedFrame f = bake->frames.items[frame];
+        for (int i = 0; i < f.count; i++) spc__apply_write(&bake->writes.items[f.start + i]);
+        return;
+    }
+
+    UmkaFuncContext fn = {0};
+    bool found = umkaGetFunc(ctx.umka, NULL, "__span_update", &fn)
+        || umkaGetFunc(ctx.umka, SP_PREAMBLE_MODULE, "__span_update", &fn);
+    if (!found) return;
+
+    while (bake->frames.count <= frame) {
+        arena_da_append(ctx.scene_arena, &bake->frames, (BakedFrame){0});
+    }
+    int start = bake->writes.count;
+    f64 frame_time = (f64)frame / ctx.fps;
+    f64 total = 0.0, slowest = 0.0;
+    const Updater *slowest_u = NULL;
+
+    for (int i = 0; i < ctx.updaters.count; i++) {
+        Updater *u = &ctx.updaters.items[i];
+        if (u->start > frame_time) continue;
+
+        umkaGetParam(fn.params, 0)->intVal = u->index;
+        umkaGetParam(fn.params, 1)->uintVal = u->handle;
+        umkaGetParam(fn.params, 2)->realVal = frame_time;
+
+        f64 before = GetTime();
+        ctx.updating = u;
+        SP_TRACE_BEGIN(call);
+        int err = umkaCall(ctx.umka, &fn);
+        SP_TRACE_END(call, "umkaCall");
+        ctx.updating = NULL;
+        if (err != 0) {
+            spu_print_umka_err(ctx.umka, ctx.lines);
+            printf("Updater of object %u failed, it won't be called again\n", u->obj_id);
+            u->start = INFINITY;
         }
+        f64 spent = GetTime() - before;
+
+        u->time_spent += spent;
+        u->calls++;
+        total += spent;
+        if (spent > slowest) {
+            slowest = spent;
+            slowest_u = u;
+        }
+    }
+
+    BakedFrame *f = &bake->frames.items[frame];
+    f->start = start;
+    f->count = bake->writes.count - start;
+    f->baked = true;
+    bake->dirty = true;
+
+    f64 budget = ctx.updater_budget > 0.0 ? ctx.updater_budget : SP_UPDATER_BUDGET;
+    f64 now = GetTime();
+    if (total > budget && now - ctx.updater_warned_at >= SP_UPDATER_WARN_INTERVAL) {
+        ctx.updater_warned_at = now;
+        TraceLog(LOG_WARNING, "SPAN: Updaters took %.2f ms of a %.2f ms budget, object %u's took %.2f ms (%.3f ms on average)",
+            total * 1000.0, budget * 1000.0, slowest_u->obj_id, slowest * 1000.0,
+            slowest_u->time_spent / slowest_u->calls * 1000.0);
     }
 }
 
-static void spc__main_render(void)
+void spc_main_render(Camera2D cam, IVector2 size)
 {
+    SP_TRACE_BEGIN(start);
+    RectBatch *batch = &ctx.rect_batch;
+    batch->instanced_draws = batch->instanced_rects = batch->immediate_rects = 0;
     ClearBackground(BLACK);
 
-    BeginMode2D(ctx.cam); {
-        for (int i = 0; i < ctx.objs.count; i++) {
-            Obj *obj = NULL;
-            SP_ASSERT(spc_get_obj(i, &obj));
-            spo_render(*obj);
+    spg_query(&ctx.grid, spg_view_rect(cam, size));
+
+    BeginMode2D(cam); {
+        for (int i = 0; i < ctx.grid.visible.count; i++) {
+            Id id = ctx.grid.visible.items[i];
+
+            if (ctx.store.kind[id] == OK_RECT) {
+                const Rect *r = &ctx.store.rects.items[ctx.store.payload[id]];
+                spr_batch_push(&ctx.rect_batch, ctx.state.pos[id], r->size, ctx.state.color[id]);
+            } else {
+                // NOTE: Flushing before anything else is drawn keeps the
+                // draw order identical to the order of the objects.
+                spr_batch_flush(&ctx.rect_batch);
+                spo_render(&ctx.store, &ctx.state, id);
+            }
         }
+        spr_batch_flush(&ctx.rect_batch);
     } EndMode2D();
+    SP_TRACE_END(start, "spc_main_render");
+    spc__hud_record(HS_Render);
+}
+
+void spc_toggle_dynres(void)
+{
+    DynRes *dr = &ctx.dynres;
+    dr->enabled = !dr->enabled;
+    dr->scale = 1.0f;
+    dr->avg_frame_time = 1.0f / (f32)ctx.fps;
+    dr->slow_frames = 0;
+    dr->steady_frames = 0;
+    dr->steady_needed = SP_DYNRES_STEADY_FRAMES;
+    if (!dr->enabled && IsRenderTextureValid(dr->target)) {
+        UnloadRenderTexture(dr->target);
+        dr->target = (RenderTexture){0};
+    }
+}
+
+static void spc__dynres_update(f32 frame_time)
+{
+    DynRes *dr = &ctx.dynres;
+    f32 budget = 1.0f / (f32)ctx.fps;
+    // NOTE: The first frames after the preview was idle include the time it
+    // spent sleeping, which says nothing about how heavy the scene is.
+    if (frame_time > 0.5f) frame_time = dr->avg_frame_time;
+    dr->avg_frame_time = Lerp(dr->avg_frame_time, frame_time, 0.1f);
+
+    // NOTE: With a target FPS, raylib sleeps away whatever is left of the
+    // frame, so a frame that fits in the budget can't tell how much room is
+    // left. Stepping up is therefore a guess that is undone if it turns out
+    // to be too slow.
+    if (dr->avg_frame_time > 1.15f * budget) {
+        dr->steady_frames = 0;
+        if (++dr->slow_frames >= SP_DYNRES_SLOW_FRAMES && dr->scale > SP_DYNRES_MIN_SCALE) {
+            dr->scale = fmaxf(dr->scale - SP_DYNRES_STEP, SP_DYNRES_MIN_SCALE);
+            dr->slow_frames = 0;
+            dr->avg_frame_time = budget;
+            if (GetTime() - dr->last_step_up < 2.0 && dr->steady_needed < 16*SP_DYNRES_STEADY_FRAMES) {
+                dr->steady_needed *= 2;
+            }
+        }
+    } else if (dr->avg_frame_time < 1.05f * budget) {
+        dr->slow_frames = 0;
+        if (++dr->steady_frames >= dr->steady_needed && dr->scale < 1.0f) {
+            dr->scale = fminf(dr->scale + SP_DYNRES_STEP, 1.0f);
+            dr->steady_frames = 0;
+            dr->last_step_up = GetTime();
+        }
+    }
+
+    IVector2 size = {
+        (int)(ctx.pres.x * dr->scale),
+        (int)(ctx.pres.y * dr->scale),
+    };
+    if (dr->target.texture.width != size.x || dr->target.texture.height != size.y) {
+        if (IsRenderTextureValid(dr->target)) UnloadRenderTexture(dr->target);
+        dr->target = LoadRenderTexture(size.x, size.y);
+        SetTextureFilter(dr->target.texture, TEXTURE_FILTER_BILINEAR);
+    }
+}
+
+static size_t spc__texture_bytes(void)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < ctx.store.typsts.count; i++) {
+        Texture t = ctx.store.typsts.items[i].texture;
+        if (IsTextureValid(t)) bytes += GetPixelDataSize(t.width, t.height, t.format);
+    }
+    Texture t = ctx.dynres.target.texture;
+    if (IsTextureValid(t)) bytes += GetPixelDataSize(t.width, t.height, t.format);
+    return bytes;
+}
+
+// NOTE: Graphs of the last frames, oldest first. The bars go up to two frames
+// at the target FPS, the line marks one.
+static void spc__hud_graph(HudStage stage, const char *name, IVector2 pos)
+{
+    const f32 *ms = ctx.hud.ms[stage];
+    f32 budget = 1000.0f / (f32)ctx.fps;
+    f32 max = 0.0f;
+    for (int i = 0; i < SP_HUD_SAMPLES; i++) max = fmaxf(max, ms[i]);
+    int last = (ctx.hud.head + SP_HUD_SAMPLES - 1) % SP_HUD_SAMPLES;
+    DrawText(TextFormat("%s %.2f ms, max %.2f", name, ms[last], max), pos.x, pos.y, 10, WHITE);
+
+    int y = pos.y + 12, h = SP_HUD_GRAPH_HEIGHT;
+    DrawRectangle(pos.x, y, 2*SP_HUD_SAMPLES, h, Fade(BLACK, 0.6f));
+    for (int i = 1; i < SP_HUD_SAMPLES; i++) {
+        f32 v = ms[(ctx.hud.head + i) % SP_HUD_SAMPLES];
+        int bar = (int)fminf(v / (2.0f*budget) * h, h);
+        DrawRectangle(pos.x + 2*i, y + h - bar, 2, bar, v > budget ? RED : GREEN);
+    }
+    DrawLine(pos.x, y + h/2, pos.x + 2*SP_HUD_SAMPLES, y + h/2, Fade(WHITE, 0.5f));
+}
+
+// NOTE: Everything is drawn straight from what's already there, so showing
+// the HUD doesn't allocate
+static void spc__hud_draw(IVector2 pos)
+{
+    const Task *task = ctx.current < ctx.tasks.count ? &ctx.tasks.items[ctx.current] : NULL;
+    if (task != NULL) {
+        DrawText(TextFormat("Task %d of %d, %.2f of %.2f s, %.2f s in",
+            ctx.current + 1, ctx.tasks.count, ctx.t, task->duration, spc_time()), pos.x, pos.y, 20, WHITE);
+    } else {
+        DrawText(TextFormat("Done after %d tasks, %.2f s in", ctx.tasks.count, spc_time()), pos.x, pos.y, 20, WHITE);
+    }
+
+    const SpatialGrid *grid = &ctx.grid;
+    const RectBatch *batch = &ctx.rect_batch;
+    int rects = batch->instanced_rects + batch->immediate_rects;
+    DrawText(TextFormat("Objects: %d enabled, %d drawn, %d actions playing",
+        grid->count - grid->slot_counts[GS_None], grid->visible.count,
+        task != NULL ? task->actions.count - task->events : 0), pos.x, pos.y + 25, 20, WHITE);
+    DrawText(TextFormat("Instanced: %d draws with %d rects", batch->instanced_draws, batch->instanced_rects),
+        pos.x, pos.y + 2*25, 20, WHITE);
+    DrawText(TextFormat("One by one: %d rects, %d other objects", batch->immediate_rects, grid->visible.count - rects),
+        pos.x, pos.y + 3*25, 20, WHITE);
+
+    f32 mb = 1024.f*1024.f;
+    int typsts = ctx.store.typsts.count;
+    int reused = typsts - ctx.typst_compiled;
+    DrawText(TextFormat("Typst: %d of %d formulas reused, %.1f MB of textures",
+        reused, typsts, spc__texture_bytes() / mb), pos.x, pos.y + 4*25, 20, WHITE);
+
+    const char *names[HS_COUNT] = { [HS_Update] = "update", [HS_Render] = "render", [HS_Swap] = "swap" };
+    for (int i = 0; i < HS_COUNT; i++) {
+        spc__hud_graph(i, names[i], (IVector2){pos.x + i*(2*SP_HUD_SAMPLES + 20), pos.y + 5*25});
+    }
 }
 
 static void spc__preview_render(void)
 {
+    DynRes *dr = &ctx.dynres;
+    if (dr->enabled) {
+        spc__dynres_update(GetFrameTime());
+
+        IVector2 size = {dr->target.texture.width, dr->target.texture.height};
+        Camera2D cam = ctx.cam;
+        cam.offset = Vector2Scale(cam.offset, dr->scale);
+        cam.zoom *= dr->scale;
+        BeginTextureMode(dr->target); {
+            spc_main_render(cam, size);
+        } EndTextureMode();
+    }
+
     BeginDrawing(); {
-        spc__main_render();
+        if (dr->enabled) {
+            Rectangle src = {0, 0, dr->target.texture.width, -dr->target.texture.height};
+            Rectangle dst = {0, 0, ctx.pres.x, ctx.pres.y};
+            DrawTexturePro(dr->target.texture, src, dst, Vector2Zero(), 0.0f, WHITE);
+        } else {
+            spc_main_render(ctx.cam, ctx.vres);
+        }
 
         IVector2 pos = {10, 10};
         DrawFPS(pos.x, pos.y);
+        if (dr->enabled) {
+            DrawText(TextFormat("%d%%", (int)roundf(dr->scale * 100.0f)), pos.x + 100, pos.y, 20, WHITE);
+        }
         DrawText(
             TextFormat(ctx.dt_mul > 0 ? "%dx" : "1/%dx", abs(ctx.dt_mul)),
             pos.x, pos.y + 25, 20, WHITE
         );
-        if (ctx.paused) DrawText("Paused", pos.x, pos.y + 2*25, 20, WHITE);
-    } EndDrawing();
+        f32 mb = 1024.f*1024.f;
+        DrawText(
+            TextFormat("Mem: %.1f MB scene, %.1f MB spare, %.1f MB persistent, %.1f MB umka",
+                sp_arena_used(ctx.scene_arena) / mb,
+                sp_arena_capacity(ctx.spare_arena) / mb,
+                sp_arena_used(&arena) / mb,
+                umkaGetMemUsage(ctx.umka) / mb),
+            pos.x, pos.y + 2*25, 20, WHITE
+        );
+        DrawText(TextFormat("Culled: %d objects", ctx.grid.culled), pos.x, pos.y + 3*25, 20, WHITE);
+        if (ctx.paused) DrawText("Paused", pos.x, pos.y + 4*25, 20, WHITE);
+        if (ctx.hud.shown) spc__hud_draw((IVector2){pos.x, pos.y + 5*25});
+    }
+    SP_TRACE_BEGIN(swap);
+    EndDrawing();
+    SP_TRACE_END(swap, "EndDrawing");
+    spc__hud_record(HS_Swap);
+
+    // NOTE: A paused frame doesn't update
+    Hud *hud = &ctx.hud;
+    hud->head = (hud->head + 1) % SP_HUD_SAMPLES;
+    for (int i = 0; i < HS_COUNT; i++) hud->ms[i][hud->head] = 0.0f;
 }
 
 static void spc__output_render(void)
 {
     // Render to the render texture
     BeginTextureMode(ctx.rtex); {
-        spc__main_render();
+        spc_main_render(ctx.cam, ctx.vres);
 
         SetTraceLogLevel(LOG_WARNING);
+        SP_TRACE_BEGIN(start);
         Image image = LoadImageFromTexture(ctx.rtex.texture);
+        SP_TRACE_END(start, "LoadImageFromTexture");
         SetTraceLogLevel(LOG_INFO);
-        if (!ffmpeg_send_frame(ctx.ffmpeg, image.data, image.width, image.height)) {
+        SP_TRACE_BEGIN(sent);
+        bool ok = ffmpeg_send_frame(ctx.ffmpeg, image.data, image.width, image.height);
+        SP_TRACE_END(sent, "ffmpeg_send_frame");
+        if (!ok) {
             ffmpeg_end_rendering(ctx.ffmpeg, true);
+            ctx.ffmpeg = NULL;
+            ctx.quit = true;
         }
         UnloadImage(image);
     } EndTextureMode();
+    if (ctx.headless) return;
 
     // Render to preview window
     BeginDrawing(); {
@@ -271,13 +1757,16 @@ void spc_render(void)
             SP_UNREACHABLEF("Unknown mode of render: %d", ctx.render_mode);
         } break;
     }
+    sp_trace_next_frame();
 }
 
-Id spc_next_id(void)
+void spc_idle(void)
 {
-    Id id = ctx.id_counter;
-    ctx.id_counter++;
-    return id;
+    // NOTE: Nothing is drawn while idle, so raylib never gets to poll for
+    // input through `EndDrawing`. Short sleeps keep the CPU usage close to
+    // zero while still reacting to a key press in time.
+    WaitTime(SP_IDLE_WAIT);
+    PollInputEvents();
 }
 
 void spc_print_tasks(TaskList tl)
@@ -289,104 +1778,573 @@ void spc_print_tasks(TaskList tl)
         printf("    duration = %f\n", t.duration);
         for (int k = 0; k < t.actions.count; k++) {
             Action a = t.actions.items[k];
-            printf("    [%2d] {id = %d, kind = %d, delay = %f}\n", k, a.obj_id, a.kind, a.delay);
+            printf("    [%2d] {id = %u, kind = %d, delay = %f}\n", k, a.obj_id, a.kind, a.delay);
         }
         printf("}\n");
     }
 }
 
-void spc_new_task(f64 duration)
+// NOTE: Only the objects that changed since the last reset are restored, and
+// only the moved ones are put back into their cells. Once a large part of
+// them changed, copying all of them is cheaper, as is building the grid again.
+void spc_reset(void)
+{
+    SP_ASSERT(ctx.tasks_dropped == 0 && "The tasks played before are gone");
+    int n = ctx.state.count;
+    ChangedSet *ch = &ctx.changed;
+    if (ch->ids.count > n / SP_RESET_ALL_DIV) {
+        memcpy(ctx.state.pos, ctx.orig.pos, n*sizeof(*ctx.state.pos));
+        memcpy(ctx.state.color, ctx.orig.color, n*sizeof(*ctx.state.color));
+        memcpy(ctx.state.enabled, ctx.orig.enabled, n*sizeof(*ctx.state.enabled));
+    } else {
+        for (int i = 0; i < ch->ids.count; i++) {
+            Id id = ch->ids.items[i];
+            ctx.state.pos[id] = ctx.orig.pos[id];
+            ctx.state.color[id] = ctx.orig.color[id];
+            ctx.state.enabled[id] = ctx.orig.enabled[id];
+        }
+    }
+
+    bool grid_built = ctx.grid.capacity >= n && ctx.grid.count == n;
+    bool rebuild = !grid_built || ch->moved > n / SP_GRID_REBUILD_DIV;
+    for (int i = 0; i < ch->ids.count; i++) {
+        Id id = ch->ids.items[i];
+        if (!rebuild && (ch->marked[id] & CH_Moved)) spg_update(&ctx.grid, id);
+        ch->marked[id] = 0;
+    }
+    ctx.grid.stale |= rebuild;
+    ch->ids.count = 0;
+    ch->moved = 0;
+    ctx.cam = ctx.orig_cam;
+    ctx.current = 0;
+    ctx.t = 0.0;
+    ctx.started = false;
+    ctx.paused = false;
+    ctx.quit = false;
+    ctx.dirty = true;
+}
+
+// NOTE: Releases the GPU resources of the current scene before it gets
+// replaced by a new one, except for the objects in `kept` that the new
+// scene took over. Objects streamed in after `kept` was made are never kept.
+void spc_clear_for_recomp(const bool *kept, int kept_count)
+{
+    for (int i = 0; i < ctx.store.count; i++) {
+        if (kept != NULL && i < kept_count && kept[i]) continue;
+
+        switch (ctx.store.kind[i]) {
+            case OK_TYPST: {
+                const Typst *typ = spo_payload(&ctx.store, i);
+                UnloadTexture(typ->texture);
+            } break;
+
+            default: break;
+        }
+    }
+}
+
+Id sps_next_id(Scene *sc)
+{
+    Id id = sc->id_counter;
+    sc->id_counter++;
+    return id;
+}
+
+// NOTE: Hides the objects that were removed in the last task
+static void sps__flush_removed(Scene *sc)
+{
+    for (int i = 0; i < sc->removed.count; i++) {
+        sps_add_action(sc, spo_disable(sc->removed.items[i]));
+    }
+    sc->removed.count = 0;
+}
+
+void sps_new_task(Scene *sc, f64 duration)
+{
+    arena_da_append(sc->task_arena, &sc->tasks, (Task){.duration = duration});
+    sps__flush_removed(sc);
+}
+
+void sps_add_action(Scene *sc, Action action)
+{
+    if (sc->tasks.count == 0) {
+        // NOTE: Added a task here to make sure the code below will have at
+        // least one task to attach the action to.
+        sps_new_task(sc, 0.0);
+    }
+
+    Task *last = &sc->tasks.items[sc->tasks.count - 1];
+    arena_da_append(sc->task_arena, &last->actions, action);
+}
+
+// NOTE: Tweens of the same property share a bit
+static uint8_t sps__tween_bit(ActionKind kind)
+{
+    switch (kind) {
+        case AK_Move:
+        case AK_CamMove: return 1;
+        case AK_Fade:
+        case AK_CamZoom: return 2;
+        case AK_CamRotate: return 4;
+        default: return 0;
+    }
+}
+
+static bool sps__is_noop(const Action *a)
+{
+    switch (a->kind) {
+        case AK_Wait: return true;
+        case AK_Fade: return memcmp(&a->args.fade.start, &a->args.fade.end, sizeof(Color)) == 0;
+        case AK_Move:
+        case AK_CamMove: {
+            MoveData m = a->args.move;
+            return m.start.x == m.end.x && m.start.y == m.end.y;
+        } break;
+        case AK_CamZoom:
+        case AK_CamRotate: return a->args.scalar.start == a->args.scalar.end;
+        default: return false;
+    }
+}
+
+// NOTE: Runs on every task once it's built. The actions of a task are all
+// applied on every frame of it, in order, so of the tweens of one property of
+// an object only the last one has any effect. Those, waits and tweens that
+// don't change anything are dropped. So are enables of objects that are
+// enabled already, and the enables and disables that are left are moved to
+// the front, to be applied once as events.
+static void sps__optimize_task(Scene *sc, Task *task)
+{
+    TaskOptimizer *opt = &sc->opt;
+    ActionList *al = &task->actions;
+    opt->actions_in += al->count;
+
+    int n = sc->store.count;
+    if (opt->capacity < n) {
+        opt->marks = arena_realloc(sc->arena, opt->marks, opt->capacity, n);
+        memset(opt->marks + opt->capacity, 0, n - opt->capacity);
+        opt->capacity = n;
+    }
+    opt->scratch.count = 0;
+    SP_DA_RESERVE(sc->arena, &opt->scratch, al->count);
+
+    // NOTE: Backwards, so that it's the last tween that's kept
+    uint8_t cam = 0;
+    for (int i = al->count - 1; i >= 0; i--) {
+        Action *a = &al->items[i];
+        uint8_t bit = sps__tween_bit(a->kind);
+        if (bit == 0) continue;
+
+        uint8_t *m = a->obj_id == SCENE_OBJ ? &cam : &opt->marks[a->obj_id];
+        if (*m & bit) a->kind = AK_Wait;
+        *m |= bit;
+    }
+
+    int events = 0;
+    for (int i = 0; i < al->count; i++) {
+        Action a = al->items[i];
+        if (a.obj_id != SCENE_OBJ) opt->marks[a.obj_id] = 0;
+        if (sps__is_noop(&a)) continue;
+
+        switch (a.kind) {
+            case AK_Enable: {
+                if (sc->state.enabled[a.obj_id]) continue;
+                sc->state.enabled[a.obj_id] = true;
+                al->items[events++] = a;
+            } break;
+
+            case AK_Disable: {
+                if (!sc->state.enabled[a.obj_id]) continue;
+                sc->state.enabled[a.obj_id] = false;
+                al->items[events++] = a;
+            } break;
+
+            default: {
+                opt->scratch.items[opt->scratch.count++] = a;
+            } break;
+        }
+    }
+    memcpy(al->items + events, opt->scratch.items, opt->scratch.count*sizeof(Action));
+    al->count = events + opt->scratch.count;
+    task->events = events;
+    opt->actions_out += al->count;
+}
+
+// NOTE: The last task is done being built once `play` sets its duration or
+// the sequence returns
+void sps_close_task(Scene *sc)
+{
+    if (sc->tasks.count == 0) return;
+    sps__optimize_task(sc, &sc->tasks.items[sc->tasks.count - 1]);
+}
+
+static void spo__store_reserve(Arena *a, ObjStore *store, int n)
+{
+    if (store->count + n <= store->capacity) return;
+
+    int capacity = store->capacity == 0 ? ARENA_DA_INIT_CAP : store->capacity;
+    while (capacity < store->count + n) capacity *= 2;
+    store->kind = arena_realloc(a, store->kind, store->capacity*sizeof(*store->kind), capacity*sizeof(*store->kind));
+    store->payload = arena_realloc(a, store->payload, store->capacity*sizeof(*store->payload), capacity*sizeof(*store->payload));
+    store->capacity = capacity;
+}
+
+void spo_state_reserve(Arena *a, ObjState *state, int n)
+{
+    if (state->count + n <= state->capacity) return;
+
+    int capacity = state->capacity == 0 ? ARENA_DA_INIT_CAP : state->capacity;
+    while (capacity < state->count + n) capacity *= 2;
+    state->pos = arena_realloc(a, state->pos, state->capacity*sizeof(*state->pos), capacity*sizeof(*state->pos));
+    state->color = arena_realloc(a, state->color, state->capacity*sizeof(*state->color), capacity*sizeof(*state->color));
+    state->enabled = arena_realloc(a, state->enabled, state->capacity*sizeof(*state->enabled), capacity*sizeof(*state->enabled));
+    state->capacity = capacity;
+}
+
+static void spo__state_push(ObjState *state, DVector2 pos, Color color)
+{
+    state->pos[state->count] = pos;
+    state->color[state->count] = color;
+    state->enabled[state->count] = false;
+    state->count++;
+}
+
+// NOTE: Splits `obj` up into the components, objects always start out hidden
+static void sps__handles_reserve(Arena *a, HandleTable *t, int n)
+{
+    if (t->count + n <= t->capacity) return;
+
+    int capacity = t->capacity == 0 ? ARENA_DA_INIT_CAP : t->capacity;
+    while (capacity < t->count + n) capacity *= 2;
+    t->obj = arena_realloc(a, t->obj, t->capacity*sizeof(*t->obj), capacity*sizeof(*t->obj));
+    t->gen = arena_realloc(a, t->gen, t->capacity*sizeof(*t->gen), capacity*sizeof(*t->gen));
+    t->last = arena_realloc(a, t->last, t->capacity*sizeof(*t->last), capacity*sizeof(*t->last));
+    t->capacity = capacity;
+}
+
+// NOTE: Index of the task that's being built, counting the dropped ones
+static int sps__task_index(const Scene *sc)
+{
+    return sc->tasks_dropped + (sc->tasks.count > 0 ? sc->tasks.count - 1 : 0);
+}
+
+// NOTE: Reuses the slot that was freed last, if there is one. The last slot
+// is `SP_HANDLE_NONE`'s.
+static Handle sps__handle_new(Scene *sc, Id id)
+{
+    HandleTable *t = &sc->handles;
+    uint32_t slot;
+    if (t->free != 0) {
+        slot = t->free - 1;
+        t->free = t->obj[slot];
+    } else {
+        SP_ASSERT(t->count < SP_HANDLE_MAX_SLOTS - 1 && "Too many objects at once, remove some");
+        sps__handles_reserve(sc->arena, t, 1);
+        slot = t->count++;
+        t->gen[slot] = 0;
+        t->last[slot] = 0;
+    }
+    t->obj[slot] = id;
+
+    HandleLife life = {
+        .obj = id,
+        .gen = t->gen[slot],
+        .from = sps__task_index(sc),
+        .to = INT_MAX,
+        .prev = t->last[slot],
+    };
+    arena_da_append(sc->arena, &t->lives, life);
+    t->last[slot] = t->lives.count;
+    return ((Handle)t->gen[slot] << SP_HANDLE_INDEX_BITS) | slot;
+}
+
+bool sp_handle_resolve(const HandleTable *t, Handle handle, Id *id)
+{
+    uint32_t slot = SP_HANDLE_INDEX(handle);
+    if (slot >= (uint32_t)t->count || t->gen[slot] != SP_HANDLE_GEN(handle)) return false;
+    *id = t->obj[slot];
+    return true;
+}
+
+// NOTE: Resolves `handle` to the object it named while the task at index
+// `task` played, counting the dropped ones
+bool sp_handle_resolve_at(const HandleTable *t, Handle handle, int task, Id *id)
+{
+    uint32_t slot = SP_HANDLE_INDEX(handle);
+    if (slot >= (uint32_t)t->count) return false;
+    for (int i = t->last[slot]; i != 0; i = t->lives.items[i - 1].prev) {
+        const HandleLife *life = &t->lives.items[i - 1];
+        if (life->gen != SP_HANDLE_GEN(handle) || task < life->from || task >= life->to) continue;
+        *id = life->obj;
+        return true;
+    }
+    return false;
+}
+
+void sps_remove(Scene *sc, Handle handle)
+{
+    HandleTable *t = &sc->handles;
+    Id id;
+    SP_ASSERT(sp_handle_resolve(t, handle, &id));
+
+    arena_da_append(sc->arena, &sc->removed, id);
+    uint32_t slot = SP_HANDLE_INDEX(handle);
+    // NOTE: It's hidden when the next task starts
+    t->lives.items[t->last[slot] - 1].to = sps__task_index(sc) + 1;
+    t->gen[slot]++;
+    t->obj[slot] = t->free;
+    t->free = slot + 1;
+}
+
+Handle sps_add_obj(Scene *sc, Obj obj)
+{
+    spo__store_reserve(sc->arena, &sc->store, 1);
+    spo_state_reserve(sc->arena, &sc->orig, 1);
+    spo_state_reserve(sc->arena, &sc->state, 1);
+
+    ObjStore *store = &sc->store;
+    int payload = 0;
+    switch (obj.kind) {
+        case OK_RECT: {
+            payload = store->rects.count;
+            arena_da_append(sc->arena, &store->rects, obj.as.rect);
+        } break;
+
+        case OK_TEXT: {
+            payload = store->texts.count;
+            arena_da_append(sc->arena, &store->texts, obj.as.text);
+        } break;
+
+        case OK_AXES: {
+            payload = store->axes.count;
+            arena_da_append(sc->arena, &store->axes, obj.as.axes);
+        } break;
+
+        case OK_CURVE: {
+            payload = store->curves.count;
+            arena_da_append(sc->arena, &store->curves, obj.as.curve);
+        } break;
+
+        case OK_TYPST: {
+            payload = store->typsts.count;
+            arena_da_append(sc->arena, &store->typsts, obj.as.typst);
+        } break;
+
+        default: {
+            SP_UNREACHABLEF("Unknown kind of object: %d", obj.kind);
+        } break;
+    }
+    store->kind[store->count] = (uint8_t)obj.kind;
+    store->payload[store->count] = payload;
+    store->count++;
+
+    spo__state_push(&sc->orig, obj.position, obj.color);
+    spo__state_push(&sc->state, obj.position, obj.color);
+    return sps__handle_new(sc, obj.id);
+}
+
+static int sps__cmp_hash(const void *a, const void *b)
+{
+    uint64_t x = ((const ObjHash *)a)->hash, y = ((const ObjHash *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+static uint64_t sps__obj_hash(const ObjStore *store, Id id)
+{
+    switch (store->kind[id]) {
+        case OK_CURVE: return ((const Curve *)spo_payload(store, id))->hash;
+        case OK_TYPST: return ((const Typst *)spo_payload(store, id))->hash;
+        default: return 0;
+    }
+}
+
+// NOTE: `match` is the payload of the object that was taken over
+bool sps_take_match(Scene *sc, ObjKind kind, uint64_t hash, const void **match)
+{
+    if (sc->prev.count == 0) return false;
+
+    if (sc->prev_kept == NULL) {
+        sc->prev_kept = arena_alloc(sc->arena, sc->prev.count*sizeof(bool));
+        memset(sc->prev_kept, 0, sc->prev.count*sizeof(bool));
+        for (int i = 0; i < sc->prev.count; i++) {
+            if (sc->prev.kind[i] != OK_CURVE && sc->prev.kind[i] != OK_TYPST) continue;
+            arena_da_append(sc->arena, &sc->prev_index, ((ObjHash){sps__obj_hash(&sc->prev, i), i}));
+        }
+        qsort(sc->prev_index.items, sc->prev_index.count, sizeof(ObjHash), sps__cmp_hash);
+    }
+
+    ObjHashList *idx = &sc->prev_index;
+    int lo = 0, hi = idx->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (idx->items[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    for (int i = lo; i < idx->count && idx->items[i].hash == hash; i++) {
+        int k = idx->items[i].index;
+        if (sc->prev_kept[k] || sc->prev.kind[k] != kind) continue;
+
+        sc->prev_kept[k] = true;
+        sc->reused++;
+        *match = spo_payload(&sc->prev, k);
+        return true;
+    }
+    return false;
+}
+
+// NOTE: Makes room for `objs` more objects and `actions` more actions in the
+// current task, so batches get appended without growing the lists each time
+void sps_reserve(Scene *sc, int objs, int actions)
 {
-    arena_da_append(&arena, &ctx.tasks, (Task){.duration = duration});
+    spo__store_reserve(sc->arena, &sc->store, objs);
+    spo_state_reserve(sc->arena, &sc->orig, objs);
+    spo_state_reserve(sc->arena, &sc->state, objs);
+    sps__handles_reserve(sc->arena, &sc->handles, objs);
+    if (actions > 0) {
+        if (sc->tasks.count == 0) sps_new_task(sc, 0.0);
+        SP_DA_RESERVE(sc->task_arena, &sc->tasks.items[sc->tasks.count - 1].actions, actions);
+    }
 }
 
-void spc_add_action(Action action)
+void sps_fade_in(Scene *sc, Id obj_id, f64 delay)
 {
-    if (ctx.tasks.count == 0) {
-        // NOTE: Added a task here to make sure the code below will have at
-        // least one task to attach the action to.
-        spc_new_task(0.0);
+    SP_ASSERT(obj_id < (Id)sc->state.count);
+    Color *current = spo_color(&sc->state, &sc->store, obj_id);
+
+    FadeData fade = {
+        .start = ColorAlpha(*current, 0.0),
+        .end = ColorAlpha(*current, 1.0),
+    };
+
+    Action action = {
+        .obj_id = obj_id,
+        .delay = delay,
+        .kind = AK_Fade,
+        .args = {.fade = fade},
+    };
+
+    if (!sc->state.enabled[obj_id]) {
+        // It need to be enabled first to be rendered on the screen.
+        sps_add_action(sc, spo_enable(obj_id));
     }
+    sps_add_action(sc, action);
 
-    Task *last = &ctx.tasks.items[ctx.tasks.count - 1];
-    arena_da_append(&arena, &last->actions, action);
+    // Update the obj's prop
+    *current = fade.end;
 }
 
-bool spc_get_obj(Id id, Obj **obj)
+void sps_move(Scene *sc, Id obj_id, DVector2 pos, f64 delay)
 {
-    if (id < ctx.objs.count) {
-        *obj = &ctx.objs.items[id];
-        return true;
-    } else {
-        return false;
+    SP_ASSERT(obj_id < (Id)sc->state.count);
+    DVector2 *current = spo_pos(&sc->state, &sc->store, obj_id);
+
+    MoveData move = {
+        .start = *current,
+        .end = pos,
+    };
+
+    Action action = {
+        .obj_id = obj_id,
+        .delay = delay,
+        .kind = AK_Move,
+        .args = {.move = move},
+    };
+
+    if (!sc->state.enabled[obj_id]) {
+        // It need to be enabled first to be rendered on the screen.
+        sps_add_action(sc, spo_enable(obj_id));
     }
+    sps_add_action(sc, action);
+
+    // Update the obj's prop
+    *current = move.end;
 }
 
-void spc_reset(void)
+// NOTE: Runs the sequence up to its next `play`
+bool sps_step(Scene *sc)
 {
-    for (int i = 0; i < ctx.objs.count; i++) {
-        ctx.objs.items[i] = ctx.orig_objs.items[i];
+    UmkaStackSlot *result = NULL;
+    f64 start = sp_now();
+    if (!spu_call_fn(sc, "__span_step", &result, 0)) return false;
+    sc->done = result->intVal != 0;
+    sc->profile.sequence_time += sp_now() - start;
+    sc->profile.steps++;
+    SP_TRACE_END(start, "sequence");
+    if (sc->done) {
+        // NOTE: There's no next task for the last removals to be applied in
+        sps__flush_removed(sc);
+        sps_close_task(sc);
+        TraceLog(LOG_INFO, "SPAN: Optimized %d actions down to %d", sc->opt.actions_in, sc->opt.actions_out);
+        sp_profile_report(sc);
     }
-    ctx.current = 0;
-    ctx.t = 0.0f;
-    ctx.paused = false;
-    ctx.quit = false;
+    return true;
 }
 
-// NOTE: For tasks, clear does not mean clear the list and free the memory.
-void spc_clear_for_recomp(void)
+// NOTE: Builds tasks until the ones that are done cover `time` with
+// `SP_STREAM_AHEAD` more after it, or until the sequence returns.
+bool sps_build_until(Scene *sc, f64 time)
 {
-    // NOTE (cont.): It just means that I will move the count variable
-    // to zero so as to write new tasks over the old ones. The memory
-    // will cleaned up at the end.
-    ctx.tasks.count = 0;
+    f64 built = 0.0;
+    int after = 0;
+    int counted = 0;
+    while (!sc->done) {
+        // NOTE: The last task is still being built
+        for (; counted < sc->tasks.count - 1; counted++) {
+            if (built > time) after++;
+            built += sc->tasks.items[counted].duration;
+        }
+        if (built > time && after >= SP_STREAM_AHEAD) break;
+        if (!sps_step(sc)) return false;
+    }
+    return true;
+}
 
-    for (int i = 0; i < ctx.objs.count; i++) {
-        Obj *o = &ctx.objs.items[i];
-        switch (o->kind) {
-            case OK_TYPST: {
-                UnloadTexture(o->as.typst.texture);
-            }
+// NOTE: Only for scenes that never made it into `ctx`
+void sps_free(Scene *sc)
+{
+    if (sc == NULL) return;
 
-            default: break;
-        }
+    // NOTE: The images of a cached scene are part of its mapping
+    for (int i = 0; i < sc->store.typsts.count && sc->map == NULL; i++) {
+        UnloadImage(sc->store.typsts.items[i].image);
     }
+    if (sc->umka != NULL) umkaFree(sc->umka);
+    if (sc->map != NULL) munmap(sc->map, sc->map_size);
+    spc__recycle_arena(sc->arena);
+    free(sc);
 }
 
-Obj spo_rect(DVector2 pos, DVector2 size, Color color)
+Obj spo_rect(Scene *sc, DVector2 pos, DVector2 size, Color color)
 {
     return (Obj) {
-        .id = spc_next_id(),
+        .id = sps_next_id(sc),
         .kind = OK_RECT,
-        .enabled = false,
+        .position = pos,
+        .color = color,
         .as = {
             .rect = {
-                .position = pos,
                 .size = size,
-                .color = color,
             }
         }
     };
 }
 
-Obj spo_text(const char *str, DVector2 pos, f32 font_size, Color color)
+Obj spo_text(Scene *sc, const char *str, DVector2 pos, f32 font_size, Color color)
 {
     return (Obj) {
-        .id = spc_next_id(),
+        .id = sps_next_id(sc),
         .kind = OK_TEXT,
-        .enabled = false,
+        .position = pos,
+        .color = color,
         .as = {
             .text = {
-                .str = arena_strdup(&arena, str),
-                .position = pos,
+                .str = arena_strdup(sc->arena, str),
                 .font_size = font_size,
-                .color = color,
             }
         }
     };
 }
 
-Obj spo_axes(Vector2 center, f32 xmin, f32 xmax, f32 ymin, f32 ymax)
+Obj spo_axes(Scene *sc, Vector2 center, f32 xmin, f32 xmax, f32 ymin, f32 ymax)
 {
     Vector2 size = {550.f, 550.f};
     Vector2 pos = Vector2Subtract(center, Vector2Scale(size, 0.5));
@@ -414,59 +2372,85 @@ Obj spo_axes(Vector2 center, f32 xmin, f32 xmax, f32 ymin, f32 ymax)
     );
 
     return (Obj){
-        .id = spc_next_id(),
+        .id = sps_next_id(sc),
         .kind = OK_AXES,
-        .enabled = false,
         .as = { .axes = axes },
     };
 }
 
-Obj spo_typst(const char *text, f32 font_size, DVector2 pos, Color color)
+Obj spo_typst(Scene *sc, const char *text, f32 font_size, DVector2 pos, Color color)
 {
     Typst typ = {
-        .text = text,
+        .text = arena_strdup(sc->arena, text),
         .font_size = font_size,
-        .position = pos,
-        .color = color,
     };
-    spo_typst_compile(&typ);
+    typ.hash = sp_hash(SP_HASH_INIT, text, strlen(text));
+    typ.hash = sp_hash(typ.hash, &font_size, sizeof(font_size));
+
+    const Typst *match = NULL;
+    if (sps_take_match(sc, OK_TYPST, typ.hash, (const void **)&match)) {
+        typ.texture = match->texture;
+    } else {
+        f64 start = sp_now();
+        spo_typst_compile(&typ);
+        sc->typst_compiled++;
+        sc->profile.typst_time += sp_now() - start;
+        sc->profile.typst_runs++;
+    }
 
     return (Obj){
-        .id = spc_next_id(),
+        .id = sps_next_id(sc),
         .kind = OK_TYPST,
-        .enabled = false,
+        .position = pos,
+        .color = color,
         .as = { .typst = typ },
     };
 }
 
 bool spo_typst_compile(Typst *typ)
 {
-    if (!IsWindowReady()) {
-        printf("Chillout bruv...\n");
-        return false;
-    }
-
     Nob_String_Builder sb = {0};
     nob_sb_appendf(&sb,
         "#set page(width: auto, height: auto, margin: 0in, fill: none)\n"
         "#set text(size: %fpt, fill: white)\n"
         "$ %s $\n", typ->font_size , typ->text);
 
-    bool ok = nob_write_entire_file("input.typ", sb.items, sb.count);
-    if (!ok) return false;
+    // NOTE: Formulas get compiled on the reload thread and by the streaming
+    // sequence on the main thread at the same time, so each compile gets
+    // files of its own.
+    static atomic_int counter = 0;
+    int n = atomic_fetch_add(&counter, 1);
+    char input_path[64], output_path[64];
+    snprintf(input_path, sizeof(input_path), "span-typst-%d.typ", n);
+    snprintf(output_path, sizeof(output_path), "span-typst-%d.png", n);
+
+    bool ok = nob_write_entire_file(input_path, sb.items, sb.count);
     nob_sb_free(sb);
+    if (!ok) return false;
 
+    SP_TRACE_BEGIN(start);
     Nob_Cmd cmd = {0};
-    const char *output_path = "output.png";
-    nob_cmd_append(&cmd, "typst", "c", "input.typ", output_path);
-    if (!nob_cmd_run_sync(cmd)) {
+    nob_cmd_append(&cmd, "typst", "c", input_path, output_path);
+    ok = nob_cmd_run_sync(cmd);
+    if (ok) {
+        typ->image = LoadImage(output_path);
+    } else {
         printf("Failed to run command\n");
-        return false;
     }
+    SP_TRACE_END(start, "spo_typst_compile");
+    remove(input_path);
+    remove(output_path);
+    return ok && IsImageValid(typ->image);
+}
+
+void spo_typst_upload(Typst *typ)
+{
+    if (!IsImageValid(typ->image)) return;
 
-    typ->texture = LoadTexture(output_path);
+    typ->texture = LoadTextureFromImage(typ->image);
     SetTextureFilter(typ->texture, TEXTURE_FILTER_BILINEAR);
-    return true;
+    UnloadImage(typ->image);
+    typ->image = (Image){0};
 }
 
 static Vector2 spo_curve_plot(const Axes *const axes, Vector2 pt)
@@ -479,118 +2463,276 @@ static Vector2 spo_curve_plot(const Axes *const axes, Vector2 pt)
     };
 }
 
-Obj spo_curve(Id axes_id)
+// NOTE: Same Catmull-Rom evaluation as raylib's `DrawSplineCatmullRom`, but
+// the result is kept as one triangle strip instead of being recomputed on
+// every draw.
+static PointList spo__curve_tessellate(Arena *a, PointList pts, f32 thick)
+{
+    PointList strip = {0};
+    if (pts.count < 4) return strip;
+
+    Vector2 current = pts.items[1];
+    for (int i = 0; i < pts.count - 3; i++) {
+        Vector2 p1 = pts.items[i], p2 = pts.items[i + 1];
+        Vector2 p3 = pts.items[i + 2], p4 = pts.items[i + 3];
+
+        for (int j = 1; j <= SP_CURVE_DIVISIONS; j++) {
+            f32 t = (f32)j / (f32)SP_CURVE_DIVISIONS;
+            f32 t2 = t*t, t3 = t2*t;
+            Vector2 next = {
+                .x = 0.5f*((-p1.x + 3.f*p2.x - 3.f*p3.x + p4.x)*t3
+                    + (2.f*p1.x - 5.f*p2.x + 4.f*p3.x - p4.x)*t2
+                    + (-p1.x + p3.x)*t + 2.f*p2.x),
+                .y = 0.5f*((-p1.y + 3.f*p2.y - 3.f*p3.y + p4.y)*t3
+                    + (2.f*p1.y - 5.f*p2.y + 4.f*p3.y - p4.y)*t2
+                    + (-p1.y + p3.y)*t + 2.f*p2.y),
+            };
+
+            f32 dx = next.x - current.x;
+            f32 dy = next.y - current.y;
+            f32 len = sqrtf(dx*dx + dy*dy);
+            if (len > 0.f) {
+                f32 size = 0.5f*thick / len;
+                Vector2 normal = {dy*size, -dx*size};
+                if (strip.count == 0) {
+                    arena_da_append(a, &strip, Vector2Add(current, normal));
+                    arena_da_append(a, &strip, Vector2Subtract(current, normal));
+                }
+                arena_da_append(a, &strip, Vector2Add(next, normal));
+                arena_da_append(a, &strip, Vector2Subtract(next, normal));
+            }
+            current = next;
+        }
+    }
+    return strip;
+}
+
+Obj spo_curve(Scene *sc, Id axes_id, int points)
 {
-    Obj axes_obj = ctx.objs.items[axes_id];
-    SP_ASSERT(axes_obj.kind == OK_AXES);
-    const Axes *axes = &axes_obj.as.axes;
+    SP_ASSERT(axes_id < (Id)sc->store.count && sc->store.kind[axes_id] == OK_AXES);
+    const Axes *axes = spo_payload(&sc->store, axes_id);
+    Color color = BLUE;
+
+    // NOTE: The points only depend on the axes they're plotted on
+    uint64_t hash = SP_HASH_INIT;
+    hash = sp_hash(hash, &axes->xmin, 4*sizeof(axes->xmin));
+    hash = sp_hash(hash, &axes->box, sizeof(axes->box));
+    hash = sp_hash(hash, &axes->origin_pos, sizeof(axes->origin_pos));
+    hash = sp_hash(hash, &points, sizeof(points));
+
+    const Curve *c = NULL;
+    if (sps_take_match(sc, OK_CURVE, hash, (const void **)&c)) {
+        PointList pts = c->pts, strip = c->strip;
+        pts.items = arena_memdup(sc->arena, pts.items, pts.count*sizeof(Vector2));
+        pts.capacity = pts.count;
+        strip.items = arena_memdup(sc->arena, strip.items, strip.count*sizeof(Vector2));
+        strip.capacity = strip.count;
+
+        return (Obj) {
+            .id = sps_next_id(sc),
+            .kind = OK_CURVE,
+            .color = color,
+            .as = {
+                .curve = {
+                    .axes_id = axes_id,
+                    .hash = hash,
+                    .pts = pts,
+                    .strip = strip,
+                }
+            }
+        };
+    }
 
     PointList pts = {0};
-    int n = 350;
-    f64 dx = (axes->xmax - axes->xmin) / (f32)n;
+    f64 dx = (axes->xmax - axes->xmin) / (f32)points;
     Vector2 p = {0};
     for (f64 x = axes->xmin; x <= axes->xmax; x += dx) {
         p = (Vector2){x, x*x - 1.f};
         p = spo_curve_plot(axes, p);
-        arena_da_append(&arena, &pts, p);
+        arena_da_append(sc->arena, &pts, p);
     }
     // NOTE: Padding final value for catmull-rom spline rendering is required
     // to ensure that the final point gets rendered
-    arena_da_append(&arena, &pts, p);
+    arena_da_append(sc->arena, &pts, p);
 
     return (Obj) {
-        .id = spc_next_id(),
-        .enabled = false,
+        .id = sps_next_id(sc),
         .kind = OK_CURVE,
+        .color = color,
         .as = {
             .curve = {
                 .axes_id = axes_id,
+                .hash = hash,
                 .pts = pts,
-                .color = BLUE,
+                .strip = spo__curve_tessellate(sc->arena, pts, SP_CURVE_THICKNESS),
             }
         }
     };
 }
 
-void spo_get_pos(Obj *obj, DVector2 **pos)
+int spo_kind_count(const ObjStore *store, ObjKind kind)
 {
-    switch (obj->kind) {
-        case OK_RECT: {
-            *pos = &obj->as.rect.position;
-        } break;
+    switch (kind) {
+        case OK_RECT: return store->rects.count;
+        case OK_TEXT: return store->texts.count;
+        case OK_AXES: return store->axes.count;
+        case OK_CURVE: return store->curves.count;
+        case OK_TYPST: return store->typsts.count;
+        default: return 0;
+    }
+}
 
-        case OK_TEXT: {
-            *pos = &obj->as.text.position;
+void *spo_payload(const ObjStore *store, Id id)
+{
+    int i = store->payload[id];
+    switch (store->kind[id]) {
+        case OK_RECT: return &store->rects.items[i];
+        case OK_TEXT: return &store->texts.items[i];
+        case OK_AXES: return &store->axes.items[i];
+        case OK_CURVE: return &store->curves.items[i];
+        case OK_TYPST: return &store->typsts.items[i];
+        default: {
+            SP_UNREACHABLEF("Unknown kind of object: %d", store->kind[id]);
         } break;
+    }
+    return NULL;
+}
 
-        case OK_TYPST: {
-            *pos = &obj->as.typst.position;
+// NOTE: Axes and curves are placed by what they're plotted on, so only the
+// other kinds can be moved
+DVector2 *spo_pos(ObjState *state, const ObjStore *store, Id id)
+{
+    switch (store->kind[id]) {
+        case OK_RECT:
+        case OK_TEXT:
+        case OK_TYPST: return &state->pos[id];
+        default: {
+            SP_UNREACHABLEF("Unknown kind of object: %d", store->kind[id]);
         } break;
+    }
+    return NULL;
+}
 
+Color *spo_color(ObjState *state, const ObjStore *store, Id id)
+{
+    switch (store->kind[id]) {
+        case OK_RECT:
+        case OK_TEXT:
+        case OK_TYPST: return &state->color[id];
         default: {
-            SP_UNREACHABLEF("Unknown kind of object: %d", obj->kind);
+            SP_UNREACHABLEF("Unknown kind of object: %d", store->kind[id]);
         } break;
     }
+    return NULL;
+}
+
+// NOTE: This is only used for the font value for now
+static f32 spv__adjusted_value(f32 f)
+{
+    return (f / (f32)ctx.pres.y) * ctx.vres.y;
+}
+
+// NOTE: Scaled by the height alone, a video with another aspect ratio than
+// the preview just shows more or less on the sides
+static Vector2 spv__adjusted_coords(Vector2 v)
+{
+    return (Vector2){ spv__adjusted_value(v.x), spv__adjusted_value(v.y) };
+}
+
+static void spo__rect_bounds(DVector2 position, DVector2 rect_size, Vector2 *pos, Vector2 *size)
+{
+    Vector2 p = Vector2Scale(spv_dtof(position), UNIT_TO_PX);
+    Vector2 s = Vector2Scale(spv_dtof(rect_size), UNIT_TO_PX);
+    p = Vector2Subtract(p, Vector2Scale(s, 0.5));
+
+    *pos = spv__adjusted_coords(p);
+    *size = spv__adjusted_coords(s);
 }
 
-void spo_get_color(Obj *obj, Color **color)
+// NOTE: Bounds are in the same space that `spo_render` draws in, i.e. what
+// is inside of `BeginMode2D`. Lines are padded by their thickness.
+Rectangle spo_bounds(const ObjStore *store, const ObjState *state, Id id)
 {
-    switch (obj->kind) {
+    const void *payload = spo_payload(store, id);
+    switch (store->kind[id]) {
         case OK_RECT: {
-            *color = &obj->as.rect.color;
+            Vector2 pos, size;
+            spo__rect_bounds(state->pos[id], ((const Rect *)payload)->size, &pos, &size);
+            return (Rectangle){pos.x, pos.y, size.x, size.y};
         } break;
 
         case OK_TEXT: {
-            *color = &obj->as.text.color;
+            const Text *t = payload;
+            Vector2 text_dim = MeasureTextEx(GetFontDefault(), t->str, t->font_size, 2.0f);
+            Vector2 pos = Vector2Scale(spv_dtof(state->pos[id]), UNIT_TO_PX);
+            pos = spv__adjusted_coords(Vector2Subtract(pos, Vector2Scale(text_dim, 0.5)));
+            Vector2 size = spv__adjusted_coords(text_dim);
+            return (Rectangle){pos.x, pos.y, size.x, size.y};
+        } break;
+
+        case OK_AXES: {
+            Rectangle box = ((const Axes *)payload)->box;
+            return (Rectangle){box.x - 2.f, box.y - 2.f, box.width + 4.f, box.height + 4.f};
+        } break;
+
+        case OK_CURVE: {
+            const PointList *pts = &((const Curve *)payload)->pts;
+            if (pts->count == 0) return (Rectangle){0};
+
+            Vector2 min = pts->items[0], max = pts->items[0];
+            for (int i = 1; i < pts->count; i++) {
+                min = Vector2Min(min, pts->items[i]);
+                max = Vector2Max(max, pts->items[i]);
+            }
+            f32 pad = SP_CURVE_THICKNESS;
+            return (Rectangle){min.x - pad, min.y - pad, max.x - min.x + 2*pad, max.y - min.y + 2*pad};
         } break;
 
         case OK_TYPST: {
-            *color = &obj->as.typst.color;
+            const Typst *t = payload;
+            Vector2 tex_dim = {t->texture.width, t->texture.height};
+            Vector2 pos = Vector2Subtract(
+                Vector2Scale(spv_dtof(state->pos[id]), UNIT_TO_PX),
+                Vector2Scale(tex_dim, 0.5));
+            return (Rectangle){pos.x, pos.y, tex_dim.x, tex_dim.y};
         } break;
 
         default: {
-            SP_UNREACHABLEF("Unknown kind of object: %d", obj->kind);
+            SP_UNREACHABLEF("Unknown kind of object: %d", store->kind[id]);
         } break;
     }
 }
 
-// NOTE: This is only used for the font value for now
-static f32 spv__adjusted_value(f32 f)
-{
-    return (f / (f32)ctx.pres.y) * ctx.vres.y;
-}
-
-static Vector2 spv__adjusted_coords(Vector2 v)
+// NOTE: Axes and curves don't have a color, so they can't be faded out
+bool spo_visible(const ObjStore *store, const ObjState *state, Id id)
 {
-    return Vector2Multiply(
-        Vector2Divide(v, spv_itof(ctx.pres)),
-        spv_itof(ctx.vres)
-    );
+    if (!state->enabled[id]) return false;
+    switch (store->kind[id]) {
+        case OK_AXES:
+        case OK_CURVE: return true;
+        default: return state->color[id].a > 0;
+    }
 }
 
-void spo_render(Obj obj)
+void spo_render(const ObjStore *store, const ObjState *state, Id id)
 {
-    if (!obj.enabled) return;
+    if (!state->enabled[id]) return;
 
-    switch (obj.kind) {
+    const void *payload = spo_payload(store, id);
+    Color color = state->color[id];
+    switch (store->kind[id]) {
         case OK_RECT: {
-            Rect r = obj.as.rect;
-            Vector2 pos = Vector2Scale(spv_dtof(r.position), UNIT_TO_PX);
-            Vector2 size = Vector2Scale(spv_dtof(r.size), UNIT_TO_PX);
-            pos = Vector2Subtract(pos, Vector2Scale(size, 0.5));
-
-            DrawRectangleV(
-                spv__adjusted_coords(pos),
-                spv__adjusted_coords(size),
-                r.color);
+            Vector2 pos, size;
+            spo__rect_bounds(state->pos[id], ((const Rect *)payload)->size, &pos, &size);
+            DrawRectangleV(pos, size, color);
         } break;
 
         case OK_TEXT: {
-            Text t = obj.as.text;
+            const Text t = *(const Text *)payload;
             Font font = GetFontDefault();
             f32 spacing = 2.0f;
 
-            Vector2 pos = Vector2Scale(spv_dtof(t.position), UNIT_TO_PX);
+            Vector2 pos = Vector2Scale(spv_dtof(state->pos[id]), UNIT_TO_PX);
             f32 font_size = t.font_size;
             Vector2 text_dim = MeasureTextEx(font, t.str, font_size, spacing);
             pos = Vector2Subtract(pos, Vector2Scale(text_dim, 0.5));
@@ -600,49 +2742,411 @@ void spo_render(Obj obj)
                 spv__adjusted_coords(pos),
                 spv__adjusted_value(font_size),
                 spv__adjusted_value(spacing),
-                t.color);
+                color);
         } break;
 
         case OK_AXES: {
-            const Axes *axes = &obj.as.axes;
+            const Axes *axes = payload;
             Vector2 start, end;
             f32 thickness = 2.f;
             // NOTE: Boundary rectangle - render only for debug purposes
             // DrawRectangleLinesEx(axes->box, 2.f, LIGHTGRAY);
 
-            if (axes->xmin <= 0.f && 0.f <= axes->xmax) {
-                // Vertical axis
-                start = (Vector2){axes->origin_pos.x, axes->box.y};
-                end = (Vector2){axes->origin_pos.x, axes->box.y + axes->box.height};
-                DrawLineEx(start, end, thickness, RED);
+            if (axes->xmin <= 0.f && 0.f <= axes->xmax) {
+                // Vertical axis
+                start = (Vector2){axes->origin_pos.x, axes->box.y};
+                end = (Vector2){axes->origin_pos.x, axes->box.y + axes->box.height};
+                DrawLineEx(start, end, thickness, RED);
+            }
+
+            if (axes->ymin <= 0.f && 0.f <= axes->ymax) {
+                // Horizontal axis
+                start = (Vector2) {axes->box.x, -axes->origin_pos.y};
+                end = (Vector2) {axes->box.x + axes->box.width, -axes->origin_pos.y};
+                DrawLineEx(start, end, thickness, RED);
+            }
+        } break;
+
+        case OK_CURVE: {
+            const Curve *c = payload;
+            if (c->strip.count == 0) break;
+            // NOTE: Round caps on both ends, like `DrawSplineCatmullRom`
+            // draws them. The spline starts at the second point and ends at
+            // the second to last one.
+            DrawCircleV(c->pts.items[1], 0.5f*SP_CURVE_THICKNESS, color);
+            DrawTriangleStrip(c->strip.items, c->strip.count, color);
+            DrawCircleV(c->pts.items[c->pts.count - 2], 0.5f*SP_CURVE_THICKNESS, color);
+        } break;
+
+        case OK_TYPST: {
+            const Typst *t = payload;
+            IVector2 tex_dim = {t->texture.width, t->texture.height};
+            Vector2 pos = Vector2Subtract(
+                Vector2Scale(spv_dtof(state->pos[id]), UNIT_TO_PX),
+                Vector2Scale(spv_itof(tex_dim), 0.5));
+            DrawTextureV(t->texture, pos, color);
+        } break;
+
+        default: {
+            SP_UNREACHABLEF("Unknown kind of object: %d", store->kind[id]);
+        } break;
+    }
+}
+
+static const char *spr__rect_vs =
+    "#version 330\n"
+    "in vec2 vertexPosition;\n"
+    "in vec4 instanceRect;\n"
+    "in vec4 instanceColor;\n"
+    "uniform mat4 mvp;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = instanceColor;\n"
+    "    vec2 p = instanceRect.xy + vertexPosition*instanceRect.zw;\n"
+    "    gl_Position = mvp*vec4(p, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *spr__rect_fs =
+    "#version 330\n"
+    "in vec4 fragColor;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    finalColor = fragColor;\n"
+    "}\n";
+
+static void spr__batch_setup_instances(RectBatch *batch, int capacity)
+{
+    rlEnableVertexArray(batch->vao);
+    if (batch->inst_vbo != 0) rlUnloadVertexBuffer(batch->inst_vbo);
+    batch->inst_vbo = rlLoadVertexBuffer(NULL, capacity*(int)sizeof(RectInstance), true);
+    batch->inst_capacity = capacity;
+
+    int rect_loc = rlGetLocationAttrib(batch->shader.id, "instanceRect");
+    int color_loc = rlGetLocationAttrib(batch->shader.id, "instanceColor");
+    rlSetVertexAttribute(rect_loc, 4, RL_FLOAT, false,
+        sizeof(RectInstance), offsetof(RectInstance, x));
+    rlEnableVertexAttribute(rect_loc);
+    rlSetVertexAttributeDivisor(rect_loc, 1);
+    rlSetVertexAttribute(color_loc, 4, RL_UNSIGNED_BYTE, true,
+        sizeof(RectInstance), offsetof(RectInstance, color));
+    rlEnableVertexAttribute(color_loc);
+    rlSetVertexAttributeDivisor(color_loc, 1);
+    rlDisableVertexArray();
+}
+
+void spr_batch_init(RectBatch *batch)
+{
+    *batch = (RectBatch){0};
+
+    // NOTE: Instancing needs GLSL 330. Anything older just falls back to
+    // drawing each rectangle through raylib.
+    int version = rlGetVersion();
+    if (version != RL_OPENGL_33 && version != RL_OPENGL_43) return;
+
+    batch->shader = LoadShaderFromMemory(spr__rect_vs, spr__rect_fs);
+    if (!IsShaderValid(batch->shader)) return;
+    batch->mvp_loc = GetShaderLocation(batch->shader, "mvp");
+
+    // NOTE: Unit quad in the same winding as raylib's `DrawRectangle`
+    const f32 quad[] = {
+        0.f, 0.f,  0.f, 1.f,  1.f, 1.f,
+        0.f, 0.f,  1.f, 1.f,  1.f, 0.f,
+    };
+    batch->vao = rlLoadVertexArray();
+    rlEnableVertexArray(batch->vao);
+    batch->quad_vbo = rlLoadVertexBuffer(quad, sizeof(quad), false);
+    int pos_loc = rlGetLocationAttrib(batch->shader.id, "vertexPosition");
+    rlSetVertexAttribute(pos_loc, 2, RL_FLOAT, false, 0, 0);
+    rlEnableVertexAttribute(pos_loc);
+    rlDisableVertexArray();
+
+    spr__batch_setup_instances(batch, 1024);
+    batch->ready = true;
+}
+
+void spr_batch_deinit(RectBatch *batch)
+{
+    if (!batch->ready) return;
+
+    rlUnloadVertexBuffer(batch->inst_vbo);
+    rlUnloadVertexBuffer(batch->quad_vbo);
+    rlUnloadVertexArray(batch->vao);
+    UnloadShader(batch->shader);
+    batch->ready = false;
+}
+
+void spr_batch_push(RectBatch *batch, DVector2 position, DVector2 rect_size, Color color)
+{
+    Vector2 pos, size;
+    spo__rect_bounds(position, rect_size, &pos, &size);
+
+    RectInstance inst = {
+        .x = pos.x, .y = pos.y,
+        .w = size.x, .h = size.y,
+        .color = color,
+    };
+    arena_da_append(&arena, &batch->pending, inst);
+}
+
+void spr_batch_flush(RectBatch *batch)
+{
+    RectInstanceList *p = &batch->pending;
+    if (p->count == 0) return;
+
+    if (!batch->ready || p->count < SP_INSTANCING_MIN_RUN) {
+        for (int i = 0; i < p->count; i++) {
+            RectInstance inst = p->items[i];
+            DrawRectangleV((Vector2){inst.x, inst.y}, (Vector2){inst.w, inst.h}, inst.color);
+        }
+        batch->immediate_rects += p->count;
+        p->count = 0;
+        return;
+    }
+
+    // NOTE: Whatever raylib has batched so far has to hit the screen first,
+    // otherwise it would end up on top of these rectangles.
+    rlDrawRenderBatchActive();
+
+    if (p->count > batch->inst_capacity) {
+        int capacity = batch->inst_capacity;
+        while (capacity < p->count) capacity *= 2;
+        spr__batch_setup_instances(batch, capacity);
+    }
+    rlUpdateVertexBuffer(batch->inst_vbo, p->items, p->count*(int)sizeof(RectInstance), 0);
+
+    Matrix mvp = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+    rlEnableShader(batch->shader.id);
+    rlSetUniformMatrix(batch->mvp_loc, mvp);
+    rlEnableVertexArray(batch->vao);
+    rlDrawVertexArrayInstanced(0, 6, p->count);
+    rlDisableVertexArray();
+    rlDisableShader();
+    batch->instanced_draws++;
+    batch->instanced_rects += p->count;
+
+    p->count = 0;
+}
+
+// NOTE: Clamped so that huge bounds still convert to an int, objects that
+// far out are in the `large` list anyway
+static int spg__cell(f32 v)
+{
+    f32 c = floorf(v / SP_GRID_CELL_SIZE);
+    return (int)fmaxf(fminf(c, SP_GRID_MAX_COORD), -SP_GRID_MAX_COORD);
+}
+
+static CellSpan spg__span(Rectangle r)
+{
+    return (CellSpan){
+        .x0 = spg__cell(r.x),
+        .y0 = spg__cell(r.y),
+        .x1 = spg__cell(r.x + r.width),
+        .y1 = spg__cell(r.y + r.height),
+    };
+}
+
+static int64_t spg__span_cells(CellSpan s)
+{
+    return ((int64_t)s.x1 - s.x0 + 1) * ((int64_t)s.y1 - s.y0 + 1);
+}
+
+static IdList *spg__bucket(SpatialGrid *grid, int cx, int cy)
+{
+    uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+    return &grid->buckets[h % SP_GRID_BUCKETS];
+}
+
+static void spg__remove_from(IdList *list, Id id)
+{
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i] == id) {
+            list->items[i] = list->items[--list->count];
+            return;
+        }
+    }
+}
+
+static void spg__set_slot(SpatialGrid *grid, Id id, GridSlot slot)
+{
+    grid->slot_counts[grid->slots[id]]--;
+    grid->slot_counts[slot]++;
+    grid->slots[id] = slot;
+}
+
+static void spg__insert(SpatialGrid *grid, Id id, CellSpan s)
+{
+    if (spg__span_cells(s) > SP_GRID_MAX_CELLS) {
+        arena_da_append(&arena, &grid->large, id);
+        spg__set_slot(grid, id, GS_Large);
+    } else {
+        for (int cy = s.y0; cy <= s.y1; cy++) {
+            for (int cx = s.x0; cx <= s.x1; cx++) {
+                arena_da_append(&arena, spg__bucket(grid, cx, cy), id);
+            }
+        }
+        spg__set_slot(grid, id, GS_Cells);
+    }
+    grid->spans[id] = s;
+}
+
+static void spg__remove(SpatialGrid *grid, Id id)
+{
+    CellSpan s = grid->spans[id];
+    switch (grid->slots[id]) {
+        case GS_None:
+        case GS_Hidden: break;
+
+        case GS_Large: {
+            spg__remove_from(&grid->large, id);
+        } break;
+
+        case GS_Cells: {
+            for (int cy = s.y0; cy <= s.y1; cy++) {
+                for (int cx = s.x0; cx <= s.x1; cx++) {
+                    spg__remove_from(spg__bucket(grid, cx, cy), id);
+                }
+            }
+        } break;
+
+        default: {
+            SP_UNREACHABLEF("Unknown grid slot: %d", grid->slots[id]);
+        } break;
+    }
+    spg__set_slot(grid, id, GS_None);
+}
+
+// NOTE: Puts an object that isn't in the grid into it, as long as it can be
+// seen at all
+static void spg__file(SpatialGrid *grid, Id id)
+{
+    if (!ctx.state.enabled[id]) return;
+    if (!spo_visible(&ctx.store, &ctx.state, id)) {
+        spg__set_slot(grid, id, GS_Hidden);
+        return;
+    }
+    spg__insert(grid, id, spg__span(spo_bounds(&ctx.store, &ctx.state, id)));
+}
+
+void spg_build(SpatialGrid *grid)
+{
+    if (grid->buckets == NULL) {
+        grid->buckets = arena_alloc(&arena, SP_GRID_BUCKETS*sizeof(IdList));
+        memset(grid->buckets, 0, SP_GRID_BUCKETS*sizeof(IdList));
+    }
+    for (int i = 0; i < SP_GRID_BUCKETS; i++) grid->buckets[i].count = 0;
+    grid->large.count = 0;
+
+    int n = ctx.state.count;
+    if (grid->capacity < n) {
+        grid->spans = arena_alloc(ctx.scene_arena, n*sizeof(CellSpan));
+        grid->slots = arena_alloc(ctx.scene_arena, n*sizeof(GridSlot));
+        grid->stamps = arena_alloc(ctx.scene_arena, n*sizeof(uint32_t));
+        memset(grid->stamps, 0, n*sizeof(uint32_t));
+        grid->stamp = 0;
+        grid->capacity = n;
+    }
+    grid->count = n;
+    grid->stale = false;
+
+    memset(grid->slot_counts, 0, sizeof(grid->slot_counts));
+    grid->slot_counts[GS_None] = n;
+    for (int i = 0; i < n; i++) {
+        grid->slots[i] = GS_None;
+        spg__file(grid, (Id)i);
+    }
+}
+
+// NOTE: Called for objects that moved, or were enabled, disabled, faded
+// out all the way or back in
+void spg_update(SpatialGrid *grid, Id id)
+{
+    if (grid->stale || id >= (Id)grid->count) return;
+
+    GridSlot slot = grid->slots[id];
+    if ((slot == GS_Cells || slot == GS_Large) && spo_visible(&ctx.store, &ctx.state, id)) {
+        CellSpan s = spg__span(spo_bounds(&ctx.store, &ctx.state, id));
+        CellSpan old = grid->spans[id];
+        if (memcmp(&s, &old, sizeof(s)) == 0) return;
+
+        spg__remove(grid, id);
+        spg__insert(grid, id, s);
+        return;
+    }
+    spg__remove(grid, id);
+    spg__file(grid, id);
+}
+
+static bool spg__overlaps(CellSpan s, CellSpan vs)
+{
+    return s.x1 >= vs.x0 && s.x0 <= vs.x1 && s.y1 >= vs.y0 && s.y0 <= vs.y1;
+}
+
+static int spg__cmp_id(const void *a, const void *b)
+{
+    Id x = *(const Id *)a, y = *(const Id *)b;
+    return (x > y) - (x < y);
+}
+
+void spg_query(SpatialGrid *grid, Rectangle view)
+{
+    if (grid->stale) spg_build(grid);
+    grid->visible.count = 0;
+
+    int filed = grid->slot_counts[GS_Cells] + grid->slot_counts[GS_Large];
+    CellSpan vs = spg__span(view);
+    // NOTE: When zoomed out far enough, walking the cells costs more than
+    // just walking every object, so skip the grid altogether.
+    if (spg__span_cells(vs) > grid->count) {
+        for (int i = 0; i < grid->count; i++) {
+            GridSlot slot = grid->slots[i];
+            if (slot == GS_Large || (slot == GS_Cells && spg__overlaps(grid->spans[i], vs))) {
+                arena_da_append(&arena, &grid->visible, (Id)i);
             }
+        }
+        grid->culled = grid->slot_counts[GS_Hidden] + filed - grid->visible.count;
+        return;
+    }
 
-            if (axes->ymin <= 0.f && 0.f <= axes->ymax) {
-                // Horizontal axis
-                start = (Vector2) {axes->box.x, -axes->origin_pos.y};
-                end = (Vector2) {axes->box.x + axes->box.width, -axes->origin_pos.y};
-                DrawLineEx(start, end, thickness, RED);
+    grid->stamp++;
+    for (int i = 0; i < grid->large.count; i++) {
+        Id id = grid->large.items[i];
+        grid->stamps[id] = grid->stamp;
+        arena_da_append(&arena, &grid->visible, id);
+    }
+    for (int cy = vs.y0; cy <= vs.y1; cy++) {
+        for (int cx = vs.x0; cx <= vs.x1; cx++) {
+            IdList *bucket = spg__bucket(grid, cx, cy);
+            for (int i = 0; i < bucket->count; i++) {
+                Id id = bucket->items[i];
+                if (grid->stamps[id] == grid->stamp) continue;
+
+                // NOTE: Different cells can hash into the same bucket, so the
+                // object's own cells still have to be checked against the view.
+                if (!spg__overlaps(grid->spans[id], vs)) continue;
+
+                grid->stamps[id] = grid->stamp;
+                arena_da_append(&arena, &grid->visible, id);
             }
-        } break;
-
-        case OK_CURVE: {
-            Curve c = obj.as.curve;
-            DrawSplineCatmullRom(c.pts.items, c.pts.count, 4.f, c.color);
-        } break;
-
-        case OK_TYPST: {
-            Typst t = obj.as.typst;
-            IVector2 tex_dim = {t.texture.width, t.texture.height};
-            Vector2 pos = Vector2Subtract(
-                Vector2Scale(spv_dtof(t.position), UNIT_TO_PX),
-                Vector2Scale(spv_itof(tex_dim), 0.5));
-            DrawTextureV(t.texture, pos, t.color);
-        } break;
+        }
+    }
+    qsort(grid->visible.items, grid->visible.count, sizeof(Id), spg__cmp_id);
+    grid->culled = grid->slot_counts[GS_Hidden] + filed - grid->visible.count;
+}
 
-        default: {
-            SP_UNREACHABLEF("Unknown kind of object: %d", obj.kind);
-        } break;
+Rectangle spg_view_rect(Camera2D cam, IVector2 size)
+{
+    Vector2 corners[4] = {
+        GetScreenToWorld2D((Vector2){0, 0}, cam),
+        GetScreenToWorld2D((Vector2){size.x, 0}, cam),
+        GetScreenToWorld2D((Vector2){0, size.y}, cam),
+        GetScreenToWorld2D((Vector2){size.x, size.y}, cam),
+    };
+    Vector2 min = corners[0], max = corners[0];
+    for (int i = 1; i < 4; i++) {
+        min = Vector2Min(min, corners[i]);
+        max = Vector2Max(max, corners[i]);
     }
+    return (Rectangle){min.x, min.y, max.x - min.x, max.y - min.y};
 }
 
 Action spo_enable(Id obj_id)
@@ -655,45 +3159,107 @@ Action spo_enable(Id obj_id)
     };
 }
 
-void spu_run_sequence(void)
+Action spo_disable(Id obj_id)
 {
-    spu_call_fn("sequence", NULL, 0);
+    return (Action) {
+        .delay = 0.0,
+        .obj_id = obj_id,
+        .kind = AK_Disable,
+        // NOTE: args should be left empty
+    };
 }
 
-static void spu__preamble_count_lines(const char *preamble)
+// NOTE: Appended to every script. It wraps `sequence` in a fiber, which the
+// `play` in the preamble yields from.
+static const char *spu__sequence_driver =
+    "var __span_seq: fiber\n"
+    "var __span_done: bool\n"
+    "fn __span_start*() { __span_seq = make(fiber, fn() { sequence(); __span_done = true }) }\n"
+    "fn __span_step*(): bool { resume(__span_seq); return __span_done }\n";
+
+bool spu_run_sequence(Scene *sc)
 {
-    int count = 1;
-    for (int i = 0; i < (int)strlen(preamble); i++) {
-        if (preamble[i] == '\n') count++;
-    }
-    ctx.preamble_lines = count;
+    return spu_call_fn(sc, "__span_start", NULL, 0);
+}
+
+// NOTE: Externs can't be given any extra arguments, so the scene that's being
+// built is found through the metadata of the Umka instance that called them.
+static Scene *spu__scene(UmkaStackSlot *r)
+{
+    Scene *sc = umkaGetMetadata(umkaGetInstance(r));
+    SP_ASSERT(sc != NULL && "Objects and actions can only be added from sequence()");
+    return sc;
+}
+
+// NOTE: Umka names modules by their absolute path, so whether the error is
+// in the main module is decided by the file it names
+static bool spu__is_main_module(const char *file_name)
+{
+    struct stat a, b;
+    if (file_name == NULL || stat(file_name, &a) != 0 || stat(ctx.filename, &b) != 0) return false;
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+static bool spu__in_preamble(const char *file_name, int line, LineMap lines)
+{
+    return spu__is_main_module(file_name)
+        && line > lines.import_lines && line <= lines.import_lines + lines.preamble_lines;
 }
 
-void spu_print_err(void)
+static void spu__print_location(const char *file_name, int line, int pos, LineMap lines)
 {
-    UmkaError *err = umkaGetError(ctx.umka);
-    if (err->line <= ctx.preamble_lines) {
-        printf("preamble:%d:%d: %s\n", err->line, err->pos, err->msg);
+    if (!spu__is_main_module(file_name)) {
+        printf("%s:%d:%d: ", file_name, line, pos);
+    } else if (line <= lines.import_lines) {
+        printf("%s:%d:%d: ", ctx.filename, line, pos);
+    } else if (line <= lines.import_lines + lines.preamble_lines) {
+        printf("preamble:%d:%d: ", line - lines.import_lines, pos);
     } else {
-        int line_no = err->line - ctx.preamble_lines;
-        printf("%s:%d:%d: %s\n", err->fnName, line_no, err->pos, err->msg);
+        printf("%s:%d:%d: ", ctx.filename, line - lines.preamble_lines, pos);
+    }
+}
+
+void spu_print_umka_err(void *umka, LineMap lines)
+{
+    UmkaError *err = umkaGetError(umka);
+    spu__print_location(err->fileName, err->line, err->pos, lines);
+    printf("%s\n", err->msg);
+    if (!spu__in_preamble(err->fileName, err->line, lines)) return;
+
+    // NOTE: Errors the preamble raises are about how it was called, so where
+    // the script called it is shown as well. Umka gives the line of the
+    // return address, which for a call on its own is the next statement.
+    char file_name[PATH_MAX], fn_name[256];
+    int offset, line;
+    for (int depth = 1; umkaGetCallStack(umka, depth, sizeof(file_name), &offset, file_name, fn_name, &line); depth++) {
+        if (spu__in_preamble(file_name, line, lines)) continue;
+        spu__print_location(file_name, line, 1, lines);
+        printf("near the call from %s\n", fn_name);
+        break;
     }
 }
 
-bool spu_call_fn(const char *fn_name, UmkaStackSlot **slot, size_t storage_bytes)
+void spu_print_err(Scene *sc)
+{
+    spu_print_umka_err(sc->umka, sc->lines);
+}
+
+bool spu_call_fn(Scene *sc, const char *fn_name, UmkaStackSlot **slot, size_t storage_bytes)
 {
     UmkaFuncContext fn = {0};
-    bool umkaOk = umkaGetFunc(ctx.umka, NULL, fn_name, &fn);
+    bool umkaOk = umkaGetFunc(sc->umka, NULL, fn_name, &fn);
     if (!umkaOk)
         return false;
 
     if (storage_bytes > 0) {
-        umkaGetResult(fn.params, fn.result)->ptrVal = arena_alloc(&arena, storage_bytes);
+        umkaGetResult(fn.params, fn.result)->ptrVal = arena_alloc(sc->arena, storage_bytes);
     }
 
-    umkaOk = umkaCall(ctx.umka, &fn) == 0;
+    SP_TRACE_BEGIN(start);
+    umkaOk = umkaCall(sc->umka, &fn) == 0;
+    SP_TRACE_END(start, "umkaCall");
     if (!umkaOk) {
-        spu_print_err();
+        spu_print_err(sc);
         return false;
     }
 
@@ -705,164 +3271,320 @@ bool spu_call_fn(const char *fn_name, UmkaStackSlot **slot, size_t storage_bytes
     return true;
 }
 
-bool spu_content_w_preamble(const char *filename, char **content)
+bool spu_content_w_preamble(Scene *sc, const char *filename, char **content)
 {
-    char preamble[2*1024] = {0};
-
-    FILE *fp = fopen("preamble.um", "r");
-    if (fp == NULL) {
+    // NOTE: Every module the script reaches is part of the key, or editing
+    // one of them would bring back the scene from before the edit
+    SourceWalk walk;
+    Source *main = spc__walk_sources(filename, &walk);
+    if (main == NULL) {
         fprintf(stderr, "[ERROR] Could not find '%s'\n", filename);
         return false;
     }
+    const char *preamble = ctx.preamble.source;
+    int preamble_lines = ctx.preamble.lines;
+    // NOTE: Externs can only be declared once per instance, and two copies of
+    // the preamble would also have two distinct `Vec2`s. Once any module
+    // imports it, the main script has to as well and it isn't pasted.
+    if (walk.imports_preamble) {
+        preamble = "";
+        preamble_lines = 1;
+    }
 
-    // Source: https://stackoverflow.com/questions/238603/how-can-i-get-a-files-size-in-c
-    fseek(fp, 0L, SEEK_END);
-    size_t fsz = ftell(fp);
-    rewind(fp);
-    fread(preamble, fsz, 1, fp);
-    preamble[strlen(preamble)] = '\0';
-    fclose(fp);
-    spu__preamble_count_lines(preamble);
-
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[ERROR] Could not find '%s'\n", filename);
-        return false;
+    // NOTE: Imports have to come first in a module, so the preamble goes
+    // right after the lines they're on
+    ImportScan scan = { .src = main->data, .size = main->size };
+    const char *path;
+    int len;
+    while (spu__next_import(&scan, &path, &len)) {}
+    size_t head = scan.end;
+    while (head > 0 && head < main->size && main->data[head - 1] != '\n') head++;
+
+    int import_lines = 0;
+    for (size_t i = 0; i < head; i++) {
+        if (main->data[i] == '\n') import_lines++;
+    }
+    const char *sep = "";
+    if (head > 0 && main->data[head - 1] != '\n') {
+        sep = "\n";
+        import_lines++;
     }
 
-    fseek(fp, 0L, SEEK_END);
-    fsz = ftell(fp);
-    rewind(fp);
+    sc->lines = (LineMap){ .import_lines = import_lines, .preamble_lines = preamble_lines };
+    *content = arena_sprintf(sc->arena, "%.*s%s%s\n%.*s\n%s",
+        (int)head, main->data, sep, preamble,
+        (int)(main->size - head), main->data + head, spu__sequence_driver);
+
+    // NOTE: The build of span is part of the key, since the layout of the
+    // cached structs and what the externs produce can change with it
+    static const char engine[] = __DATE__ " " __TIME__;
+    int version = SP_CACHE_VERSION;
+    uint64_t key = sp_hash(SP_HASH_INIT, *content, strlen(*content));
+    key = sp_hash(key, &walk.hash, sizeof(walk.hash));
+    key = sp_hash(key, ctx.preamble.source, strlen(ctx.preamble.source));
+    key = sp_hash(key, &version, sizeof(version));
+    key = sp_hash(key, engine, sizeof(engine));
+    sc->bake_key = sp_hash(key, &ctx.fps, sizeof(ctx.fps));
+    key = sp_hash(key, &ctx.pres, sizeof(ctx.pres));
+    key = sp_hash(key, &ctx.vres, sizeof(ctx.vres));
+    sc->cache_key = key;
+    return true;
+}
 
-    char *file_content = arena_alloc(&arena, fsz + 1);
-    fread(file_content, fsz, 1, fp);
-    file_content[fsz] = '\0';
-    fclose(fp);
+static void spu__bad_handle(const char *name, Handle handle)
+{
+    fprintf(stderr, "[ERROR] %s: there's no object %llu (slot %u, generation %u), it was removed or never made\n",
+        name, (unsigned long long)handle, SP_HANDLE_INDEX(handle), SP_HANDLE_GEN(handle));
+}
 
-    *content = arena_sprintf(&arena, "%s\n%s", preamble, file_content);
-    return true;
+// NOTE: Calls with a handle that doesn't resolve are skipped
+static bool spu__resolve(Scene *sc, Handle handle, Id *id, const char *name)
+{
+    if (sp_handle_resolve(&sc->handles, handle, id)) return true;
+    spu__bad_handle(name, handle);
+    return false;
 }
 
 void spuo_rect(UmkaStackSlot *p, UmkaStackSlot *r)
 {
+    Scene *sc = spu__scene(r);
     DVector2 pos = *(DVector2 *)umkaGetParam(p, 0);
     DVector2 size = *(DVector2 *)umkaGetParam(p, 1);
     Color color = *(Color *)umkaGetParam(p, 2);
 
-    Obj rect = spo_rect(pos, size, color);
-    umkaGetResult(p, r)->intVal = rect.id;
-
-    arena_da_append(&arena, &ctx.objs, rect);
-    arena_da_append(&arena, &ctx.orig_objs, rect);
+    Obj rect = spo_rect(sc, pos, size, color);
+    umkaGetResult(p, r)->uintVal = sps_add_obj(sc, rect);
 }
 
 void spuo_text(UmkaStackSlot *p, UmkaStackSlot *r)
 {
+    Scene *sc = spu__scene(r);
     const unsigned char *text_str = (const unsigned char *)(umkaGetParam(p, 0)->ptrVal);
     DVector2 pos = *(DVector2 *)umkaGetParam(p, 1);
     f32 font_size = *(f32 *)umkaGetParam(p, 2);
     Color color = *(Color *)umkaGetParam(p, 3);
 
-    Obj text = spo_text((const char *)text_str, pos, font_size, color);
-    umkaGetResult(p, r)->intVal = text.id;
-
-    arena_da_append(&arena, &ctx.objs, text);
-    arena_da_append(&arena, &ctx.orig_objs, text);
+    Obj text = spo_text(sc, (const char *)text_str, pos, font_size, color);
+    umkaGetResult(p, r)->uintVal = sps_add_obj(sc, text);
 }
 
 void spuo_axes(UmkaStackSlot *p, UmkaStackSlot *r)
 {
+    Scene *sc = spu__scene(r);
     DVector2 center = *(DVector2 *)umkaGetParam(p, 0);
     f64 xmin = *(f64 *)umkaGetParam(p, 1);
     f64 xmax = *(f64 *)umkaGetParam(p, 2);
     f64 ymin = *(f64 *)umkaGetParam(p, 3);
     f64 ymax = *(f64 *)umkaGetParam(p, 4);
 
-    Obj axes = spo_axes(spv_dtof(center), xmin, xmax, ymin, ymax);
-    umkaGetResult(p, r)->intVal = axes.id;
-
-    arena_da_append(&arena, &ctx.objs, axes);
-    arena_da_append(&arena, &ctx.orig_objs, axes);
+    Obj axes = spo_axes(sc, spv_dtof(center), xmin, xmax, ymin, ymax);
+    umkaGetResult(p, r)->uintVal = sps_add_obj(sc, axes);
 }
 
 void spuo_curve(UmkaStackSlot *p, UmkaStackSlot *r)
 {
-    Id axes_id = *(Id *)umkaGetParam(p, 0);
-
-    Obj curve = spo_curve(axes_id);
-    umkaGetResult(p, r)->intVal = curve.id;
+    Scene *sc = spu__scene(r);
+    Id axes_id;
+    umkaGetResult(p, r)->uintVal = SP_HANDLE_NONE;
+    if (!spu__resolve(sc, *(Handle *)umkaGetParam(p, 0), &axes_id, "curve")) return;
+    int points = (int)umkaGetParam(p, 1)->intVal;
+    if (points < 1) {
+        fprintf(stderr, "[ERROR] curve: can't plot %d points\n", points);
+        return;
+    }
 
-    arena_da_append(&arena, &ctx.objs, curve);
-    arena_da_append(&arena, &ctx.orig_objs, curve);
+    Obj curve = spo_curve(sc, axes_id, points);
+    umkaGetResult(p, r)->uintVal = sps_add_obj(sc, curve);
 }
 
 void spuo_typst(UmkaStackSlot *p, UmkaStackSlot *r)
 {
+    Scene *sc = spu__scene(r);
     const unsigned char *text = (const unsigned char *)(umkaGetParam(p, 0)->ptrVal);
     f32 font_size = (f32)umkaGetParam(p, 1)->realVal;
     DVector2 pos = *(DVector2 *)umkaGetParam(p, 2);
     Color color = *(Color *)umkaGetParam(p, 3);
 
-    Obj typst = spo_typst((const char *)text, font_size, pos, color);
-    umkaGetResult(p, r)->intVal = typst.id;
-
-    arena_da_append(&arena, &ctx.objs, typst);
-    arena_da_append(&arena, &ctx.orig_objs, typst);
+    Obj typst = spo_typst(sc, (const char *)text, font_size, pos, color);
+    umkaGetResult(p, r)->uintVal = sps_add_obj(sc, typst);
 }
 
 void spuo_enable(UmkaStackSlot *p, UmkaStackSlot *r)
 {
-    SP_UNUSED(r);
-    Id obj_id = *(Id *)umkaGetParam(p, 0);
+    Scene *sc = spu__scene(r);
+    Id obj_id;
+    if (!spu__resolve(sc, *(Handle *)umkaGetParam(p, 0), &obj_id, "enable")) return;
 
-    spc_add_action(spo_enable(obj_id));
+    sps_add_action(sc, spo_enable(obj_id));
 }
 
-void spu_fade_in(UmkaStackSlot *p, UmkaStackSlot *r)
+void spuo_remove(UmkaStackSlot *p, UmkaStackSlot *r)
 {
-    SP_UNUSED(r);
+    Scene *sc = spu__scene(r);
+    Handle handle = *(Handle *)umkaGetParam(p, 0);
+    Id obj_id;
+    if (!spu__resolve(sc, handle, &obj_id, "remove")) return;
+
+    sps_remove(sc, handle);
+}
+
+// NOTE: The batch variants below cross the FFI once for a whole array. Their
+// per-item arguments either match the ids/positions one to one or hold a
+// single item that's used for all of them.
+// NOTE: The preamble checks the lengths before calling in, see
+// `__batch_check`. A call that gets here anyway does nothing instead of
+// reading past the end, -1 is returned for it.
+static int spu__batch_len(const void *arr, int n, const char *msg)
+{
+    int len = umkaGetDynArrayLen(arr);
+    if (len != n && len > 1) {
+        fprintf(stderr, "[ERROR] %s, got %d for %d\n", msg, len, n);
+        return -1;
+    }
+    return len;
+}
+
+void spuo_rects(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    void *umka = umkaGetInstance(r);
+    Scene *sc = spu__scene(r);
+    UmkaDynArray(DVector2) *pos = (void *)umkaGetParam(p, 0);
+    UmkaDynArray(DVector2) *size = (void *)umkaGetParam(p, 1);
+    UmkaDynArray(Color) *color = (void *)umkaGetParam(p, 2);
+    void *ids_type = umkaGetParam(p, 3)->ptrVal;
+
+    int n = umkaGetDynArrayLen(pos);
+    int n_size = spu__batch_len(size, n, "rects: size has to have one item or one per rect");
+    int n_color = spu__batch_len(color, n, "rects: color has to have one item or one per rect");
+    if (n_size < 0 || n_color < 0) n = 0;
+
+    UmkaDynArray(Handle) *ids = umkaGetResult(p, r)->ptrVal;
+    umkaMakeDynArray(umka, ids, ids_type, n);
+    sps_reserve(sc, n, 0);
+
+    for (int i = 0; i < n; i++) {
+        DVector2 s = n_size == 0 ? (DVector2){1, 1} : size->data[n_size == 1 ? 0 : i];
+        Color c = n_color == 0 ? WHITE : color->data[n_color == 1 ? 0 : i];
+
+        ids->data[i] = sps_add_obj(sc, spo_rect(sc, pos->data[i], s, c));
+    }
+}
 
-    Id obj_id = *(Id *)umkaGetParam(p, 0);
+void spu_fade_in_many(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+    UmkaDynArray(Handle) *ids = (void *)umkaGetParam(p, 0);
     f64 delay = *(f64 *)umkaGetParam(p, 1);
 
-    Obj *obj = NULL;
-    Color *current = NULL;
-    SP_ASSERT(spc_get_obj(obj_id, &obj));
-    spo_get_color(obj, &current);
+    int n = umkaGetDynArrayLen(ids);
+    // NOTE: Objects that aren't enabled yet need an extra action for that
+    sps_reserve(sc, 0, 2*n);
+    for (int i = 0; i < n; i++) {
+        Id obj_id;
+        if (spu__resolve(sc, ids->data[i], &obj_id, "fade_in_many")) sps_fade_in(sc, obj_id, delay);
+    }
+}
 
-    FadeData fade = {
-        .start = ColorAlpha(*current, 0.0),
-        .end = ColorAlpha(*current, 1.0),
-    };
+void spu_move_many(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+    UmkaDynArray(Handle) *ids = (void *)umkaGetParam(p, 0);
+    UmkaDynArray(DVector2) *pos = (void *)umkaGetParam(p, 1);
+    f64 delay = *(f64 *)umkaGetParam(p, 2);
 
-    Action action = {
+    int n = umkaGetDynArrayLen(ids);
+    int n_pos = spu__batch_len(pos, n, "move_many: pos has to have one item or one per id");
+    if (n_pos <= 0) return;
+
+    sps_reserve(sc, 0, 2*n);
+    for (int i = 0; i < n; i++) {
+        Id obj_id;
+        if (!spu__resolve(sc, ids->data[i], &obj_id, "move_many")) continue;
+        sps_move(sc, obj_id, pos->data[n_pos == 1 ? 0 : i], delay);
+    }
+}
+
+void spu_add_updater(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+    Handle handle = *(Handle *)umkaGetParam(p, 0);
+    int index = (int)umkaGetParam(p, 1)->intVal;
+    Id obj_id;
+    if (!spu__resolve(sc, handle, &obj_id, "add_updater")) return;
+
+    // NOTE: The last task is the one that's being built right now
+    f64 start = sc->time_dropped;
+    for (int i = 0; i < sc->tasks.count - 1; i++) start += sc->tasks.items[i].duration;
+
+    Updater u = {
+        .handle = handle,
         .obj_id = obj_id,
-        .delay = delay,
-        .kind = AK_Fade,
-        .args = {.fade = fade},
+        .index = index,
+        .start = start,
     };
+    arena_da_append(sc->arena, &sc->updaters, u);
+}
 
-    if (!obj->enabled) {
-        // It need to be enabled first to be rendered on the screen.
-        spc_add_action(spo_enable(obj_id));
+static bool spu__updater_write(Handle handle, UpdaterWrite w, const char *name)
+{
+    const Updater *u = ctx.updating;
+    if (u == NULL) {
+        fprintf(stderr, "[ERROR] %s only works inside of an updater\n", name);
+        return false;
+    }
+    // NOTE: The table is the one the sequence left behind so far, the handle
+    // is resolved as of the task that's playing. The updater's own object
+    // was resolved when it was added, it keeps being written after a removal.
+    if (handle == u->handle) {
+        w.obj_id = u->obj_id;
+    } else if (!sp_handle_resolve_at(&ctx.handles, handle, ctx.tasks_dropped + ctx.current, &w.obj_id)) {
+        spu__bad_handle(name, handle);
+        return false;
     }
-    spc_add_action(action);
+    arena_da_append(ctx.scene_arena, &ctx.bake.writes, w);
+    spc__apply_write(&w);
+    return true;
+}
 
-    // Update the obj's prop
-    *current = fade.end;
+void spu_set_pos(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    SP_UNUSED(r);
+    UpdaterWrite w = {
+        .as = {.pos = *(DVector2 *)umkaGetParam(p, 1)},
+    };
+    spu__updater_write(*(Handle *)umkaGetParam(p, 0), w, "set_pos");
 }
 
-void spu_fade_out(UmkaStackSlot *p, UmkaStackSlot *r)
+void spu_set_color(UmkaStackSlot *p, UmkaStackSlot *r)
 {
     SP_UNUSED(r);
+    UpdaterWrite w = {
+        .is_color = true,
+        .as = {.color = *(Color *)umkaGetParam(p, 1)},
+    };
+    spu__updater_write(*(Handle *)umkaGetParam(p, 0), w, "set_color");
+}
+
+void spu_fade_in(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
 
-    Id obj_id = *(Id *)umkaGetParam(p, 0);
+    Id obj_id;
+    if (!spu__resolve(sc, *(Handle *)umkaGetParam(p, 0), &obj_id, "fade_in")) return;
     f64 delay = *(f64 *)umkaGetParam(p, 1);
 
-    Obj *obj = NULL;
-    Color *current = NULL;
-    SP_ASSERT(spc_get_obj(obj_id, &obj));
-    spo_get_color(obj, &current);
+    sps_fade_in(sc, obj_id, delay);
+}
+
+void spu_fade_out(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+
+    Id obj_id;
+    if (!spu__resolve(sc, *(Handle *)umkaGetParam(p, 0), &obj_id, "fade_out")) return;
+    f64 delay = *(f64 *)umkaGetParam(p, 1);
+
+    Color *current = spo_color(&sc->state, &sc->store, obj_id);
 
     FadeData fade = {
         .start = ColorAlpha(*current, 1.0),
@@ -876,11 +3598,11 @@ void spu_fade_out(UmkaStackSlot *p, UmkaStackSlot *r)
         .args = {.fade = fade},
     };
 
-    if (!obj->enabled) {
+    if (!sc->state.enabled[obj_id]) {
         // It need to be enabled first to be rendered on the screen.
-        spc_add_action(spo_enable(obj_id));
+        sps_add_action(sc, spo_enable(obj_id));
     }
-    spc_add_action(action);
+    sps_add_action(sc, action);
 
     // Update the obj's prop
     *current = fade.end;
@@ -889,64 +3611,108 @@ void spu_fade_out(UmkaStackSlot *p, UmkaStackSlot *r)
 void spu_wait(UmkaStackSlot *p, UmkaStackSlot *r)
 {
     SP_UNUSED(p);
-    SP_UNUSED(r);
+    Scene *sc = spu__scene(r);
     Action action = {
         .obj_id = SCENE_OBJ,
         .delay = 0.0,
         .kind = AK_Wait,
         // NOTE: args should be left empty
     };
-    spc_add_action(action);
+    sps_add_action(sc, action);
 }
 
 void spu_move(UmkaStackSlot *p, UmkaStackSlot *r)
 {
-    SP_UNUSED(r);
+    Scene *sc = spu__scene(r);
 
-    Id obj_id = *(Id *)umkaGetParam(p, 0);
+    Id obj_id;
+    if (!spu__resolve(sc, *(Handle *)umkaGetParam(p, 0), &obj_id, "move")) return;
     DVector2 pos = *(DVector2 *)umkaGetParam(p, 1);
     f64 delay = *(f64 *)umkaGetParam(p, 2);
 
-    Obj *obj = NULL;
-    DVector2 *current = NULL;
-    SP_ASSERT(spc_get_obj(obj_id, &obj));
-    spo_get_pos(obj, &current);
+    sps_move(sc, obj_id, pos, delay);
+}
+
+void spu_play(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+    f64 duration = *(f64 *)umkaGetParam(p, 0);
+
+    // NOTE: Nothing was added before this one, so it just waits
+    if (sc->tasks.count == 0) sps_new_task(sc, 0.0);
+    Task *last = &sc->tasks.items[sc->tasks.count - 1];
+    last->duration = duration;
+    sps_close_task(sc);
+
+    // NOTE: the line below is just a hack for now. a new task should only be added
+    // when a new action is added. the line below just preemptively adds a task, which
+    // is good but should not be done here.
+    // TODO: remove this
+    sps_new_task(sc, 0.0);
+}
+
+void spu_camera_move(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+
+    DVector2 pos = *(DVector2 *)umkaGetParam(p, 0);
+    f64 delay = *(f64 *)umkaGetParam(p, 1);
 
+    Vector2 target = spv__adjusted_coords(Vector2Scale(spv_dtof(pos), UNIT_TO_PX));
     MoveData move = {
-        .start = *current,
-        .end = pos,
+        .start = spv_ftod(sc->cam.target),
+        .end = spv_ftod(target),
     };
 
     Action action = {
-        .obj_id = obj_id,
+        .obj_id = SCENE_OBJ,
         .delay = delay,
-        .kind = AK_Move,
+        .kind = AK_CamMove,
         .args = {.move = move},
     };
+    sps_add_action(sc, action);
 
-    if (!obj->enabled) {
-        // It need to be enabled first to be rendered on the screen.
-        spc_add_action(spo_enable(obj_id));
-    }
-    spc_add_action(action);
+    // Update the camera's prop
+    sc->cam.target = target;
+}
 
-    // Update the obj's prop
-    *current = move.end;
+void spu_camera_zoom(UmkaStackSlot *p, UmkaStackSlot *r)
+{
+    Scene *sc = spu__scene(r);
+
+    f64 zoom = *(f64 *)umkaGetParam(p, 0);
+    f64 delay = *(f64 *)umkaGetParam(p, 1);
+    SP_ASSERT(zoom > 0.0);
+
+    Action action = {
+        .obj_id = SCENE_OBJ,
+        .delay = delay,
+        .kind = AK_CamZoom,
+        .args = {.scalar = {.start = sc->cam.zoom, .end = zoom}},
+    };
+    sps_add_action(sc, action);
+
+    // Update the camera's prop
+    sc->cam.zoom = (f32)zoom;
 }
 
-void spu_play(UmkaStackSlot *p, UmkaStackSlot *r)
+void spu_camera_rotate(UmkaStackSlot *p, UmkaStackSlot *r)
 {
-    SP_UNUSED(r);
-    f64 duration = *(f64 *)umkaGetParam(p, 0);
+    Scene *sc = spu__scene(r);
 
-    Task *last = &ctx.tasks.items[ctx.tasks.count - 1];
-    last->duration = duration;
+    f64 angle = *(f64 *)umkaGetParam(p, 0);
+    f64 delay = *(f64 *)umkaGetParam(p, 1);
 
-    // NOTE: the line below is just a hack for now. a new task should only be added
-    // when a new action is added. the line below just preemptively adds a task, which
-    // is good but should not be done here.
-    // TODO: remove this
-    spc_new_task(0.0);
+    Action action = {
+        .obj_id = SCENE_OBJ,
+        .delay = delay,
+        .kind = AK_CamRotate,
+        .args = {.scalar = {.start = sc->cam.rotation, .end = angle}},
+    };
+    sps_add_action(sc, action);
+
+    // Update the camera's prop
+    sc->cam.rotation = (f32)angle;
 }
 
 void spa_interp(Action action, void **value, f32 factor)
@@ -968,12 +3734,265 @@ void spa_interp(Action action, void **value, f32 factor)
             );
         } break;
 
+        case AK_CamMove: {
+            Vector2 *v = *(Vector2**)value;
+            MoveData args = action.args.move;
+            *v = Vector2Lerp(spv_dtof(args.start), spv_dtof(args.end), factor);
+        } break;
+
+        case AK_CamZoom:
+        case AK_CamRotate: {
+            f32 *f = *(f32**)value;
+            ScalarData args = action.args.scalar;
+            *f = Lerp(args.start, args.end, factor);
+        } break;
+
         default: {
             SP_UNREACHABLEF("Unknown kind of action: %d", action.kind);
         } break;
     }
 }
 
+// NOTE: FNV-1a, chained through `h` so that several fields can be hashed
+uint64_t sp_hash(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+f64 sp_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+#if SP_TRACE
+typedef struct {
+    const char *name;
+    f64 start, duration;
+    int frame;
+} TraceEvent;
+
+// NOTE: Every thread that records a trace event gets its own ring, which only
+// it writes to. `head` counts all events ever recorded and is published after
+// the event is written, so the rings can be read without a lock. Once a ring
+// is full, the oldest events get overwritten.
+typedef struct TraceRing {
+    struct TraceRing *next;
+    int tid;
+    const char *name;
+    // NOTE: Set while a thread records into it, see `sp_trace_thread_end`
+    atomic_bool taken;
+    // NOTE: Only the thread that draws counts frames
+    bool draws;
+    int frame;
+    atomic_size_t head;
+    TraceEvent events[SP_TRACE_CAPACITY];
+} TraceRing;
+
+static _Atomic(TraceRing *) sp__trace_rings = NULL;
+static atomic_int sp__trace_tids = 0;
+static _Thread_local TraceRing *sp__trace_ring = NULL;
+static _Thread_local const char *sp__trace_name = NULL;
+
+// NOTE: Rings are never freed. A thread that's done gives its ring back, and
+// the next one with the same name takes it over, so there are only as many
+// rings as there were threads at once. Their events share a track.
+static TraceRing *sp__trace_thread_ring(void)
+{
+    TraceRing *ring = sp__trace_ring;
+    if (ring != NULL) return ring;
+
+    const char *name = sp__trace_name != NULL ? sp__trace_name : "thread";
+    for (ring = atomic_load(&sp__trace_rings); ring != NULL; ring = ring->next) {
+        bool taken = false;
+        if (strcmp(ring->name, name) != 0) continue;
+        if (atomic_compare_exchange_strong(&ring->taken, &taken, true)) break;
+    }
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(TraceRing));
+        SP_ASSERT(ring != NULL && "Buy MORE RAM lol!!");
+        ring->tid = atomic_fetch_add(&sp__trace_tids, 1) + 1;
+        ring->name = name;
+        atomic_store(&ring->taken, true);
+        ring->next = atomic_load(&sp__trace_rings);
+        while (!atomic_compare_exchange_weak(&sp__trace_rings, &ring->next, ring));
+    }
+    sp__trace_ring = ring;
+    return ring;
+}
+
+// NOTE: `name` is what the track of the calling thread is called in the trace
+void sp_trace_thread_begin(const char *name)
+{
+    sp__trace_name = name;
+}
+
+// NOTE: Called by threads before they exit, once they won't record anymore
+void sp_trace_thread_end(void)
+{
+    if (sp__trace_ring != NULL) atomic_store(&sp__trace_ring->taken, false);
+    sp__trace_ring = NULL;
+    sp__trace_name = NULL;
+}
+
+// NOTE: The HUD of the preview reads its times from the trace as well
+static bool sp__tracing(void)
+{
+    return ctx.profile_trace != NULL || ctx.hud.ms[0] != NULL;
+}
+
+f64 sp_trace_now(void)
+{
+    return sp__tracing() ? sp_now() : 0.0;
+}
+
+void sp_trace_event(const char *name, f64 start)
+{
+    if (!sp__tracing()) return;
+    f64 end = sp_now();
+    TraceRing *ring = sp__trace_thread_ring();
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head % SP_TRACE_CAPACITY] = (TraceEvent){
+        .name = name,
+        .start = start,
+        .duration = end - start,
+        .frame = ring->frame,
+    };
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// NOTE: Seconds the last event of the calling thread took, 0 without one
+f64 sp_trace_last(void)
+{
+    TraceRing *ring = sp__trace_ring;
+    if (ring == NULL) return 0.0;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return head > 0 ? ring->events[(head - 1) % SP_TRACE_CAPACITY].duration : 0.0;
+}
+
+// NOTE: Called by the thread that draws once a frame is done, the events it
+// records after that belong to the next one
+void sp_trace_next_frame(void)
+{
+    if (!sp__tracing()) return;
+    TraceRing *ring = sp__trace_thread_ring();
+    ring->draws = true;
+    ring->frame++;
+}
+
+// NOTE: Timestamps are relative to the oldest event that's still in a ring
+bool sp_trace_write(const char *path)
+{
+    f64 origin = INFINITY;
+    int count = 0;
+    for (TraceRing *r = atomic_load(&sp__trace_rings); r != NULL; r = r->next) {
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t first = head > SP_TRACE_CAPACITY ? head - SP_TRACE_CAPACITY : 0;
+        for (size_t i = first; i < head; i++) {
+            origin = fmin(origin, r->events[i % SP_TRACE_CAPACITY].start);
+        }
+    }
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "[ERROR] Could not write the trace to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(f, "{\"traceEvents\":[");
+    for (TraceRing *r = atomic_load(&sp__trace_rings); r != NULL; r = r->next) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            r == atomic_load(&sp__trace_rings) ? "" : ",", r->tid, r->name);
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t first = head > SP_TRACE_CAPACITY ? head - SP_TRACE_CAPACITY : 0;
+        for (size_t i = first; i < head; i++) {
+            TraceEvent *ev = &r->events[i % SP_TRACE_CAPACITY];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                ev->name, (ev->start - origin) * 1e6, ev->duration * 1e6, r->tid);
+            if (r->draws) fprintf(f, ",\"args\":{\"frame\":%d}", ev->frame);
+            fprintf(f, "}");
+        }
+        count += (int)(head - first);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    TraceLog(LOG_INFO, "SPAN: Wrote %d trace events to %s", count, path);
+    return true;
+}
+#else
+void sp_trace_thread_begin(const char *name) { SP_UNUSED(name); }
+void sp_trace_thread_end(void) {}
+f64 sp_trace_now(void) { return 0.0; }
+void sp_trace_event(const char *name, f64 start) { SP_UNUSED(name); SP_UNUSED(start); }
+f64 sp_trace_last(void) { return 0.0; }
+void sp_trace_next_frame(void) {}
+bool sp_trace_write(const char *path)
+{
+    fprintf(stderr, "[ERROR] Could not write the trace to %s: span was built with SP_TRACE=0\n", path);
+    return false;
+}
+#endif
+
+static int sp__profile_cmp(const void *a, const void *b)
+{
+    const ProfileEntry *x = *(ProfileEntry *const *)a, *y = *(ProfileEntry *const *)b;
+    return (x->time < y->time) - (x->time > y->time);
+}
+
+// NOTE: Printed once the sequence has returned
+void sp_profile_report(Scene *sc)
+{
+    Profile *prof = &sc->profile;
+    if (!prof->enabled) return;
+
+    ProfileEntry *sorted[SPX_COUNT];
+    for (int i = 0; i < SPX_COUNT; i++) sorted[i] = &prof->externs[i];
+    qsort(sorted, SPX_COUNT, sizeof(sorted[0]), sp__profile_cmp);
+
+    int actions = 0;
+    for (int i = 0; i < sc->tasks.count; i++) actions += sc->tasks.items[i].actions.count;
+
+    printf("Profile of %s\n", ctx.filename != NULL ? ctx.filename : "the scene");
+    printf("  %-16s %8s %12s %10s %10s\n", "extern", "calls", "total ms", "avg us", "arena KiB");
+    for (int i = 0; i < SPX_COUNT; i++) {
+        ProfileEntry *e = sorted[i];
+        if (e->calls == 0) continue;
+        printf("  %-16s %8d %12.3f %10.3f %10.1f\n", spu__externs[e - prof->externs].name,
+            e->calls, e->time * 1000.0, e->time * 1e6 / e->calls, e->bytes / 1024.0);
+    }
+    printf("  umkaCompile %.3f ms, sequence() %.3f ms in %d steps, typst %.3f ms in %d runs\n",
+        prof->compile_time * 1000.0, prof->sequence_time * 1000.0, prof->steps,
+        prof->typst_time * 1000.0, prof->typst_runs);
+    printf("  %d objects (%d reused), %d tasks, %d actions\n",
+        sc->store.count, sc->reused, sc->tasks.count, actions);
+
+}
+
+size_t sp_arena_used(const Arena *a)
+{
+    size_t bytes = 0;
+    if (a == NULL) return bytes;
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        bytes += r->count * sizeof(uintptr_t);
+    }
+    return bytes;
+}
+
+size_t sp_arena_capacity(const Arena *a)
+{
+    size_t bytes = 0;
+    if (a == NULL) return bytes;
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        bytes += r->capacity * sizeof(uintptr_t);
+    }
+    return bytes;
+}
+
 f32 sp_easing(f32 t, f32 duration)
 {
     switch (ctx.easing) {
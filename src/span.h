@@ -2,7 +2,11 @@
 #define _SPAN_H_
 
 #include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "ffmpeg.h"
+#include "watch.h"
 #include "raylib.h"
 #include "arena.h"
 #include "umka_api.h"
@@ -31,10 +35,38 @@
         int capacity;  \
     } st_name
 
+// NOTE: Tracing scopes around the stages of a frame and of a build, recorded
+// only while there's a trace to write, see `ctx.profile_trace`, or a HUD that
+// shows them. Building with -DSP_TRACE=0 removes them altogether.
+#ifndef SP_TRACE
+#define SP_TRACE 1
+#endif
+#if SP_TRACE
+#define SP_TRACE_BEGIN(t) f64 t = sp_trace_now()
+#define SP_TRACE_END(t, name) sp_trace_event((name), (t))
+#else
+#define SP_TRACE_BEGIN(t) ((void)0)
+#define SP_TRACE_END(t, name) ((void)0)
+#endif
+
+// NOTE: Grows `da` so that the next `n` appends don't have to
+#define SP_DA_RESERVE(a, da, n)                                                          \
+    do {                                                                                 \
+        if ((da)->count + (n) > (da)->capacity) {                                        \
+            int new_capacity = (da)->count + (n);                                        \
+            (da)->items = arena_realloc((a), (da)->items,                                \
+                (da)->capacity*sizeof(*(da)->items), new_capacity*sizeof(*(da)->items)); \
+            (da)->capacity = new_capacity;                                               \
+        }                                                                                \
+    } while (0)
+
 
 typedef float f32;
 typedef double f64;
-typedef uint16_t Id;
+// NOTE: `Id` is where an object is in the scene's arrays. Scripts never see
+// it, they get a `Handle` instead, see `HandleTable`.
+typedef uint32_t Id;
+typedef uint64_t Handle;
 
 typedef struct {
     int x, y;
@@ -50,6 +82,10 @@ typedef enum {
     AK_Wait,
     AK_Fade,
     AK_Move,
+    AK_CamMove,
+    AK_CamZoom,
+    AK_CamRotate,
+    AK_Disable,
 } ActionKind;
 
 typedef struct {
@@ -62,6 +98,11 @@ typedef struct {
     DVector2 end;
 } MoveData;
 
+typedef struct {
+    f64 start;
+    f64 end;
+} ScalarData;
+
 typedef struct {
     Id obj_id;
     ActionKind kind;
@@ -69,6 +110,7 @@ typedef struct {
     union {
         FadeData fade;
         MoveData move;
+        ScalarData scalar;
     } args;
 } Action;
 SP_STRUCT_ARR(ActionList, Action);
@@ -78,31 +120,35 @@ typedef struct {
     UmkaExternFunc func;
 } UmkaFunc;
 
+// NOTE: The first `events` actions are one-shot, they're applied when the
+// task starts instead of on every frame of it. See `sps__optimize_task`.
 typedef struct {
     ActionList actions;
+    int events;
     f64 duration;
 } Task;
 SP_STRUCT_ARR(TaskList, Task);
 
+// NOTE: Where an object is and its color are components of their own, see
+// `ObjState`. The structs below only hold what depends on the kind.
 typedef struct {
-    DVector2 position;
     DVector2 size;
-    Color color;
 } Rect;
+SP_STRUCT_ARR(RectList, Rect);
 
 typedef struct {
     const char *str;
-    DVector2 position;
     Vector2 norm_coords;
     f32 font_size;
-    Color color;
 } Text;
+SP_STRUCT_ARR(TextList, Text);
 
 typedef struct {
     f64 xmin, xmax, ymin, ymax;
     Rectangle box;
     Vector2 origin_pos, coord_size, center_coord;
 } Axes;
+SP_STRUCT_ARR(AxesList, Axes);
 
 SP_STRUCT_ARR(PointList, Vector2);
 // NOTE: Personally, I prefer that "children" don't possess any knowledge of
@@ -113,17 +159,29 @@ SP_STRUCT_ARR(PointList, Vector2);
 // for me to do was to make a them a separate object (not sub-object).
 typedef struct {
     Id axes_id;
+    // NOTE: Hash of everything the points depend on, see `spo_curve`
+    uint64_t hash;
     PointList pts;
-    Color color;
+    // NOTE: Triangle strip of the spline through `pts`. It's computed once
+    // when the curve is created, so panning or zooming the camera never
+    // re-tessellates it.
+    PointList strip;
 } Curve;
+SP_STRUCT_ARR(CurveList, Curve);
 
 typedef struct {
     const char *text;
     f32 font_size;
-    DVector2 position;
-    Color color;
+    // NOTE: Hash of the text and the font size, which is all that the
+    // rendered image depends on. The color is only applied when drawing.
+    uint64_t hash;
+    // NOTE: Scenes may be built off the main thread, where textures can't be
+    // created. The rendered formula waits in `image` until the scene is
+    // handed over to `ctx`, which turns it into `texture`.
+    Image image;
     Texture texture;
 } Typst;
+SP_STRUCT_ARR(TypstList, Typst);
 
 typedef enum {
     OK_RECT,
@@ -133,10 +191,13 @@ typedef enum {
     OK_TYPST,
 } ObjKind;
 
+// NOTE: An object as `spo_rect` and friends make it. It's only passed on to
+// `sps_add_obj`, which splits it up into the components of the scene.
 typedef struct {
     Id id;
     ObjKind kind;
-    bool enabled;
+    DVector2 position;
+    Color color;
     union {
         Rect rect;
         Text text;
@@ -145,7 +206,379 @@ typedef struct {
         Typst typst;
     } as;
 } Obj;
-SP_STRUCT_ARR(ObjList, Obj);
+
+// NOTE: What playing a scene changes about its objects, one dense array per
+// component indexed by Id. Every scene has the state it starts in and the one
+// it's played in, so a reset only copies these arrays.
+typedef struct {
+    DVector2 *pos;
+    Color *color;
+    bool *enabled;
+    int count, capacity;
+} ObjState;
+
+// NOTE: Everything else about the objects, which never changes once they're
+// made. `payload` is where an object is in the list of its kind.
+typedef struct {
+    uint8_t *kind;
+    int32_t *payload;
+    int count, capacity;
+    RectList rects;
+    TextList texts;
+    AxesList axes;
+    CurveList curves;
+    TypstList typsts;
+} ObjStore;
+
+// NOTE: One entry per rectangle in the per-instance GPU buffer. The layout
+// has to match the attributes set up in `spr_batch_init`.
+typedef struct {
+    f32 x, y, w, h;
+    Color color;
+} RectInstance;
+SP_STRUCT_ARR(RectInstanceList, RectInstance);
+
+typedef struct {
+    bool ready;
+    unsigned int vao, quad_vbo, inst_vbo;
+    int inst_capacity;
+    Shader shader;
+    int mvp_loc;
+    // NOTE: Consecutive rectangles (in render order) are gathered here and
+    // drawn together once a different kind of object interrupts the run.
+    RectInstanceList pending;
+    // NOTE: What was drawn since `spc_main_render` started, for the HUD.
+    // Runs too short to instance are drawn one by one through raylib.
+    int instanced_draws, instanced_rects, immediate_rects;
+} RectBatch;
+
+SP_STRUCT_ARR(IdList, Id);
+
+// NOTE: An object a slot held, from the task it was added in up to the task
+// it was hidden in by `remove`. `prev` is the one before it in the slot plus 1.
+typedef struct {
+    Id obj;
+    uint32_t gen;
+    int from, to;
+    int prev;
+} HandleLife;
+SP_STRUCT_ARR(HandleLifeList, HandleLife);
+
+// NOTE: A handle is a slot in this table in its low `SP_HANDLE_INDEX_BITS`
+// bits and the generation of the slot in the rest. Removing an object frees
+// its slot and bumps the generation, so handles to it stop resolving. With 32
+// bits, a slot would have to be reused 4 billion times for one to resolve
+// again. The
+// object itself stays in the store, the tasks before the removal still play
+// it, so removing objects doesn't free any memory. Free slots are chained
+// through `obj`, `free` is the first one plus 1.
+//
+// Updaters run long after the sequence removed objects and reused their
+// slots, so every object a slot held is kept in `lives` to resolve their
+// handles as of the task that's playing, see `sp_handle_resolve_at`.
+// `last` has the newest one of each slot plus 1.
+typedef struct {
+    Id *obj;
+    uint32_t *gen;
+    int *last;
+    int count, capacity;
+    uint32_t free;
+    HandleLifeList lives;
+} HandleTable;
+
+typedef enum {
+    CH_State = 1,
+    // NOTE: Only objects that moved, or were shown or hidden, have to be put
+    // into other cells of the grid
+    CH_Moved = 2,
+} ChangeKind;
+
+// NOTE: The objects whose state was changed since the last reset, so that a
+// reset only has to restore those. `marked` has the `ChangeKind` bits of
+// every object, `moved` is how many of them have `CH_Moved`.
+typedef struct {
+    uint8_t *marked;
+    int capacity;
+    IdList ids;
+    int moved;
+} ChangedSet;
+
+// NOTE: Range of grid cells (inclusive) that an object's bounds cover
+typedef struct {
+    int x0, y0, x1, y1;
+} CellSpan;
+
+// NOTE: Disabled objects aren't in the grid at all, enabled ones that are
+// fully transparent are only counted as `GS_Hidden`
+typedef enum {
+    GS_None,
+    GS_Hidden,
+    GS_Cells,
+    GS_Large,
+    GS_COUNT,
+} GridSlot;
+
+// NOTE: A hashed uniform grid over the bounds of every object. The grid is
+// unbounded since cells are hashed into a fixed number of buckets; an object
+// that covers too many cells is kept in the `large` list instead.
+typedef struct {
+    IdList *buckets;
+    IdList large;
+    CellSpan *spans;
+    GridSlot *slots;
+    uint32_t *stamps;
+    uint32_t stamp;
+    int count, capacity;
+    // NOTE: How many objects are in each slot
+    int slot_counts[GS_COUNT];
+    // NOTE: Set instead of building the grid when it's going to be built
+    // again anyway, it's then built by the next query. A seek that resets
+    // and applies a few tasks builds it once this way.
+    bool stale;
+
+    // NOTE: Ids of the objects that overlap the camera's view, sorted so
+    // that the draw order stays the same as without culling. The enabled
+    // objects that aren't in it are `culled`.
+    IdList visible;
+    int culled;
+} SpatialGrid;
+
+// NOTE: Adaptive render scale of the preview. The scene is rendered into
+// `target` at `scale` times the preview resolution and upscaled to the window.
+typedef struct {
+    bool enabled;
+    f32 scale;
+    f32 avg_frame_time;
+    int slow_frames, steady_frames;
+    // NOTE: Number of steady frames needed before trying a higher scale. It
+    // doubles every time a step up has to be undone, so the scale doesn't
+    // keep bouncing between two values.
+    int steady_needed;
+    f64 last_step_up;
+    RenderTexture target;
+} DynRes;
+
+typedef enum {
+    HS_Update,
+    HS_Render,
+    HS_Swap,
+    HS_COUNT,
+} HudStage;
+
+// NOTE: Overlay of the preview with what a frame costs. The times of the last
+// `SP_HUD_SAMPLES` frames are always recorded from the trace, `head` is the
+// one being measured, see `sp_trace_last`. Without SP_TRACE there are no
+// times to show. Swapping includes the wait for the next frame at the target
+// FPS.
+typedef struct {
+    bool shown;
+    f32 *ms[HS_COUNT];
+    int head;
+} Hud;
+
+// NOTE: A per-frame callback registered with `add_updater`. The closure itself
+// stays on the Umka side, `index` is where it is in the script's list.
+typedef struct {
+    Handle handle;
+    Id obj_id;
+    int index;
+    // NOTE: Scene time at which it was added, it's not called before that
+    f64 start;
+    f64 time_spent;
+    int calls;
+} Updater;
+SP_STRUCT_ARR(UpdaterList, Updater);
+
+// NOTE: State of the pass that cleans up the actions of every task, see
+// `sps__optimize_task`. `marks` has a byte per object for it.
+typedef struct {
+    int actions_in, actions_out;
+    uint8_t *marks;
+    int capacity;
+    ActionList scratch;
+} TaskOptimizer;
+
+typedef struct {
+    Id obj_id;
+    bool is_color;
+    union {
+        DVector2 pos;
+        Color color;
+    } as;
+} UpdaterWrite;
+SP_STRUCT_ARR(UpdaterWriteList, UpdaterWrite);
+
+typedef struct {
+    int start, count;
+    bool baked;
+} BakedFrame;
+SP_STRUCT_ARR(BakedFrameList, BakedFrame);
+
+// NOTE: What the updaters wrote in each frame, indexed by the frame number at
+// `ctx.fps`. Frames that were already evaluated are replayed from here, so
+// replaying, seeking or exporting them doesn't call into Umka again. It's kept
+// next to the scene cache, see `spc_bake_write`. When it was read from there,
+// `map` is what the lists point into until they grow.
+typedef struct {
+    UpdaterWriteList writes;
+    BakedFrameList frames;
+    // NOTE: `loaded` is set once the file was looked for, `dirty` once a frame
+    // was baked that isn't in it
+    bool loaded, dirty;
+    void *map;
+    size_t map_size;
+} UpdaterBake;
+
+// NOTE: Every extern a script can call, as X(umka name, C function). The
+// table that registers them and the profiling wrappers are generated from it.
+#define SPU_EXTERNS(X)                     \
+    X("rect", spuo_rect)                   \
+    X("text", spuo_text)                   \
+    X("axes", spuo_axes)                   \
+    X("curve", spuo_curve)                 \
+    X("typst", spuo_typst)                 \
+    X("fade_in", spu_fade_in)              \
+    X("fade_out", spu_fade_out)            \
+    X("move", spu_move)                    \
+    X("wait", spu_wait)                    \
+    X("__play", spu_play)                  \
+    X("camera_move", spu_camera_move)      \
+    X("camera_zoom", spu_camera_zoom)      \
+    X("camera_rotate", spu_camera_rotate)  \
+    X("enable", spuo_enable)               \
+    X("remove", spuo_remove)               \
+    X("__rects", spuo_rects)               \
+    X("fade_in_many", spu_fade_in_many)    \
+    X("__move_many", spu_move_many)        \
+    X("__add_updater", spu_add_updater)    \
+    X("set_pos", spu_set_pos)              \
+    X("set_color", spu_set_color)
+
+#define X(name, func) SPX_##func,
+typedef enum {
+    SPU_EXTERNS(X)
+    SPX_COUNT,
+} SpuExtern;
+#undef X
+
+typedef struct {
+    int calls;
+    f64 time;
+    size_t bytes;
+} ProfileEntry;
+
+// NOTE: What loading a scene cost, filled in when `ctx.profile` is set. The
+// externs are wrapped to count their calls, time and arena bytes.
+typedef struct {
+    bool enabled;
+    ProfileEntry externs[SPX_COUNT];
+    f64 compile_time, sequence_time, typst_time;
+    int steps, typst_runs;
+} Profile;
+
+typedef struct {
+    uint64_t hash;
+    int index;
+} ObjHash;
+
+SP_STRUCT_ARR(ObjHashList, ObjHash);
+
+// NOTE: The main module is the script with the preamble pasted in after its
+// imports, this is where each part ended up
+typedef struct {
+    int import_lines;
+    int preamble_lines;
+} LineMap;
+
+// NOTE: Everything that running a script produces. A scene is built on its
+// own and only handed over to `ctx` once it's complete, so a script that
+// fails to compile or run never replaces the one that's playing.
+typedef struct {
+    void *umka;
+    Arena *arena;
+    // NOTE: The objects of the scene that's playing while this one is built.
+    // A new object with the same kind and content hash as one of them takes
+    // over its texture or tessellation instead of building its own. Matches
+    // are one to one and recorded in `prev_kept`.
+    ObjStore prev;
+    ObjHashList prev_index;
+    bool *prev_kept;
+    int reused;
+    // NOTE: Formulas that had to go through typst, the others were taken over
+    // or came from the cache
+    int typst_compiled;
+    // NOTE: `sequence` runs in a fiber that yields at every `play`, so a scene
+    // is built a few tasks at a time. This is set once it has returned.
+    bool done;
+    UpdaterList updaters;
+    // NOTE: See `spc_cache_load` and `spc_bake_write`. `map` is only set for
+    // scenes read from the cache, whose objects and tasks point into it.
+    uint64_t cache_key, bake_key;
+    void *map;
+    size_t map_size;
+    Profile profile;
+    ObjStore store;
+    ObjState orig;
+    // NOTE: The objects as the sequence that's being built left them
+    ObjState state;
+    TaskList tasks;
+    // NOTE: Where the tasks and their actions are allocated, the scene's own
+    // arena until played tasks start being dropped, see `ctx.forward_only`.
+    // `tasks` starts after the first `tasks_dropped`, which took
+    // `time_dropped` seconds.
+    Arena *task_arena;
+    int tasks_dropped;
+    f64 time_dropped;
+    Id id_counter;
+    HandleTable handles;
+    // NOTE: Objects removed while the last task was being built, they're
+    // hidden once it has played, or right away when the sequence returns
+    IdList removed;
+    TaskOptimizer opt;
+    LineMap lines;
+    // NOTE: Camera state as the sequence is being built
+    Camera2D cam;
+} Scene;
+
+typedef struct {
+    Watcher *watcher;
+    // NOTE: Saves usually arrive as a burst of events, so a rebuild only
+    // starts once the files have been quiet for `SP_RELOAD_DEBOUNCE`.
+    bool pending;
+    f64 last_event;
+
+    pthread_t thread;
+    // NOTE: Whether `thread` was started, a build that couldn't get a thread
+    // of its own ran on the main thread instead
+    bool running, threaded;
+    atomic_bool done;
+    bool ok;
+    Scene *scene;
+    f64 resume_at;
+    f64 started_at, built_at;
+} Reload;
+
+// NOTE: preamble.um is read once and only read again when it changes on
+// disk. Builds running on the reload thread only ever read it.
+typedef struct {
+    char *source;
+    int lines;
+    time_t mtime;
+} Preamble;
+
+// NOTE: A module of the script, mapped to be hashed for the scene cache and
+// scanned for its imports. It's only mapped and hashed again once its size or
+// mtime changes, so a reload only reads the modules that were edited.
+typedef struct {
+    char *path;
+    const char *data;
+    size_t size;
+    int64_t mtime;
+    uint64_t hash;
+    int walk;
+    bool watched;
+} Source;
+SP_STRUCT_ARR(SourceList, Source);
 
 typedef enum {
     EM_Linear,
@@ -157,78 +590,293 @@ typedef enum {
     RM_Output,
 } RenderMode;
 
+// NOTE: A point in the scene, either in seconds or as the index of the task
+// that starts there
 typedef struct {
-    void *umka;
+    bool set, task;
+    f64 value;
+} TimePoint;
 
-    // NOTE: this object list contains the original, unmodified state of the objects
-    ObjList orig_objs;
-    ObjList objs;
+// NOTE: What span is started with, see `main.c`. Zeroes are the defaults.
+// `resolution` is the size of the video, or of the window when previewing.
+typedef struct {
+    const char *filename;
+    RenderMode mode;
+    const char *output;
+    const char *preset;
+    IVector2 resolution;
+    int fps;
+    int umka_stack_size;
+    TimePoint from, to;
+} SpanOptions;
+
+typedef struct {
+    void *umka;
+    const char *filename;
+    // NOTE: Scene data lives in per-generation arenas. `scene_arena` backs the
+    // scene that's playing. The one it replaced is reset and kept in
+    // `spare_arena`, so the next build reuses its memory instead of growing
+    // the process. Anything that outlives a scene goes into `arena`. A scene
+    // and `ctx` point to the same arena, it's never copied.
+    Arena *scene_arena;
+    Arena *spare_arena;
+    // NOTE: The scene that's playing, for as long as its sequence is still
+    // running. It keeps being built a few tasks ahead of the playhead and
+    // allocates from `scene_arena` while it does.
+    Scene *stream;
+    // NOTE: Set from the SPAN_PROFILE environment variable. Any value turns the
+    // profiler on, one other than "1" is also where the Chrome trace of every
+    // thread goes when span exits.
+    bool profile;
+    const char *profile_trace;
+    uint64_t cache_key, bake_key;
+    void *cache_map;
+    size_t cache_map_size;
+    UpdaterList updaters;
+    UpdaterBake bake;
+    // NOTE: The updater that's running, it's only then that `set_pos` and
+    // friends apply
+    const Updater *updating;
+    // NOTE: Seconds per frame all updaters together may take before there's a
+    // warning, `SP_UPDATER_BUDGET` when 0
+    f64 updater_budget;
+    f64 updater_warned_at;
+
+    // NOTE: `orig` is the state the objects start in, `state` the one that's
+    // being played. The store belongs to the scene.
+    ObjStore store;
+    ObjState orig;
+    ObjState state;
+    ChangedSet changed;
 
     TaskList tasks;
+    int tasks_dropped;
+    f64 time_dropped;
+    // NOTE: Set when playback only ever goes forward, as when rendering a
+    // video. Played tasks are then dropped, see `spc__drop_played_tasks`, so
+    // memory doesn't grow with the length of the video. Only the updaters'
+    // writes do, for the frames that weren't baked before. Seeking back is no
+    // longer possible once tasks are dropped.
+    bool forward_only;
+    Arena task_arenas[2];
+    int task_flip;
     Id id_counter;
+    // NOTE: Only needed to resolve the handles updaters write to
+    HandleTable handles;
     EaseMode easing;
 
-    int preamble_lines;
+    LineMap lines;
+    Preamble preamble;
+    // NOTE: Only touched by whoever is building a scene, which is the reload
+    // thread while it's running
+    SourceList sources;
+    Arena source_arena;
+    int source_walk;
+    // NOTE: Size of the Umka stack in slots, `SP_UMKA_STACK_SIZE` when 0
+    int umka_stack_size;
+    // NOTE: Where the video goes and the x264 preset it's encoded with
+    const char *output;
+    const char *preset;
+    // NOTE: Rendering a video stops once the scene gets here
+    f64 render_end;
     int current;
-    f32 t;
+    f64 t;
+    // NOTE: Whether the events of the current task were applied, which happens
+    // once on the first frame it shows
+    bool started;
     bool paused, quit;
+    // NOTE: Set whenever something could have changed what's on screen. The
+    // preview only redraws when it's set and otherwise sleeps until input.
+    bool dirty;
 
     // NOTE: preview window resolution, output video resolution
     IVector2 pres, vres;
-    Camera2D cam;
+    // NOTE: Like the objects, `cam` is modified while the sequence is being
+    // built and restored from `orig_cam` on reset.
+    Camera2D cam, orig_cam;
     int fps;
     RenderMode render_mode;
+    // NOTE: Rendering a video without a display draws into an EGL context
+    // instead of a window, see `headless.h`
+    bool headless;
     RenderTexture rtex;
+    DynRes dynres;
+    Hud hud;
+    RectBatch rect_batch;
+    SpatialGrid grid;
+    int typst_compiled;
     // NOTE: I'm not sure how to name this...essentially, if it is >= 1, dt
     // is multiplied by it. If it's < -1, then dt is divided by it. It can't be zero.
     int dt_mul;
 
     FFMPEG *ffmpeg;
+    Reload reload;
 } Context;
 
 #define UNIT_TO_PX 50
+// NOTE: Runs of rectangles shorter than this are left to raylib's own batch,
+// since the instanced draw has a fixed cost of its own.
+#define SP_INSTANCING_MIN_RUN 64
+#define SP_CURVE_THICKNESS 4.f
+#define SP_CURVE_DIVISIONS 24
+#define SP_IDLE_WAIT 0.05
+#define SP_RELOAD_DEBOUNCE 0.15
+#define SP_DYNRES_MIN_SCALE 0.5f
+#define SP_DYNRES_STEP 0.125f
+#define SP_DYNRES_SLOW_FRAMES 20
+#define SP_DYNRES_STEADY_FRAMES 120
+#define SP_GRID_CELL_SIZE 128.f
+#define SP_GRID_BUCKETS 4096
+#define SP_GRID_MAX_CELLS 64
+#define SP_GRID_MAX_COORD 1e9f
+#define SP_GRID_MIN_REBUILD 1024
+#define SP_GRID_REBUILD_DIV 8
+// NOTE: Past this fraction of changed objects, a reset copies all of them
+#define SP_RESET_ALL_DIV 4
 #define SCENE_OBJ ((Id)-1)
+#define SP_HANDLE_INDEX_BITS 32
+// NOTE: Slots are counted in an `int`
+#define SP_HANDLE_MAX_SLOTS INT32_MAX
+#define SP_HANDLE_INDEX(h) ((uint32_t)(h))
+#define SP_HANDLE_GEN(h) ((uint32_t)((h) >> SP_HANDLE_INDEX_BITS))
+// NOTE: What externs return for objects they couldn't make. Its slot is the
+// last one, which is never handed out, so it never resolves.
+#define SP_HANDLE_NONE ((Handle)-1)
+#define SP_HASH_INIT 14695981039346656037ull
+#define SP_PREAMBLE_PATH "preamble.um"
+#define SP_PREAMBLE_MODULE "span.um"
+// NOTE: In slots. Umka clears the whole stack on every build, and the fiber
+// `sequence` runs in gets one as large. It used to be 1M slots, 8 MB that
+// took ~4 ms of every reload to clear. Scripts that recurse deeper than 64K
+// slots allow can raise it with `--umka-stack`.
+#define SP_UMKA_STACK_SIZE (64 * 1024)
+#define SP_STREAM_AHEAD 4
+#define SP_TASK_WINDOW 256
+#define SP_CACHE_DIR ".span-cache"
+#define SP_CACHE_VERSION 3
+#define SP_UPDATER_BUDGET 0.004
+#define SP_UPDATER_WARN_INTERVAL 1.0
+#define SP_PREVIEW_RES ((IVector2){ 800, 600 })
+#define SP_OUTPUT_RES ((IVector2){ 1600, 1200 })
+// NOTE: A video is laid out like a preview window this high, with the same
+// aspect ratio, and scaled up
+#define SP_OUTPUT_LAYOUT_HEIGHT 600
+#define SP_FPS 60
+#define SP_OUTPUT_PATH "out.mov"
+#define SP_TRACE_CAPACITY (1 << 16)
+#define SP_HUD_SAMPLES 120
+#define SP_HUD_GRAPH_HEIGHT 60
 
 extern Arena arena;
 extern Context ctx;
 
 // TODO: all of these function do not need to be here; some should just be
 // static and in the `span.c` file.
-bool spc_init(const char *filename, RenderMode mode);
-bool spc_umka_init(const char *filename);
-void spc_renderer_init(RenderMode mode);
-void spc_run_umka(void);
+bool spc_init(const SpanOptions *opts);
+Scene *spc_new_scene(void);
+bool spc_time_of(TimePoint point, f64 *time);
+bool spc_umka_init(Scene *sc, const char *filename);
+bool spc_renderer_init(RenderMode mode);
+bool spc_run_umka(Scene *sc);
+bool spc_umka_compile(Scene *sc, const char *content);
+bool spc_load_preamble(void);
+Scene *spc_cache_load(uint64_t key);
+bool spc_cache_write(void);
+void spc_bake_load(void);
+bool spc_bake_write(void);
+void spc_bake_close(void);
+void spc_swap_scene(Scene *sc);
+void spc_request_reload(void);
+void spc_poll_reload(void);
 void spc_deinit(void);
-void spc_update(f32 dt);
+void spc_changed_reserve(Arena *a, int n);
+void spc_apply_task(const Task *task, f32 factor, bool start);
+void spc_update(f64 dt);
+f64 spc_time(void);
+void spc_run_updaters(f64 time);
+void spc_seek(f64 time);
 void spc_render(void);
-Id spc_next_id(void);
+// NOTE: Draws the scene as seen through `cam`, into whatever target is active
+void spc_main_render(Camera2D cam, IVector2 size);
+void spc_idle(void);
+void spc_toggle_dynres(void);
 void spc_print_tasks(TaskList tl);
-void spc_new_task(f64 duration);
-void spc_add_action(Action action);
-bool spc_get_obj(Id id, Obj **obj);
-void spc_clear_for_recomp(void);
+void spc_clear_for_recomp(const bool *kept, int kept_count);
+Id sps_next_id(Scene *sc);
+void sps_new_task(Scene *sc, f64 duration);
+void sps_close_task(Scene *sc);
+void sps_add_action(Scene *sc, Action action);
+Handle sps_add_obj(Scene *sc, Obj obj);
+void sps_remove(Scene *sc, Handle handle);
+bool sp_handle_resolve(const HandleTable *t, Handle handle, Id *id);
+bool sp_handle_resolve_at(const HandleTable *t, Handle handle, int task, Id *id);
+void sps_free(Scene *sc);
+void sps_reserve(Scene *sc, int objs, int actions);
+void sps_fade_in(Scene *sc, Id obj_id, f64 delay);
+void sps_move(Scene *sc, Id obj_id, DVector2 pos, f64 delay);
+bool sps_step(Scene *sc);
+bool sps_build_until(Scene *sc, f64 time);
+bool sps_take_match(Scene *sc, ObjKind kind, uint64_t hash, const void **match);
+uint64_t sp_hash(uint64_t h, const void *data, size_t size);
+f64 sp_now(void);
+void sp_trace_thread_begin(const char *name);
+void sp_trace_thread_end(void);
+f64 sp_trace_now(void);
+void sp_trace_event(const char *name, f64 start);
+f64 sp_trace_last(void);
+void sp_trace_next_frame(void);
+bool sp_trace_write(const char *path);
+void sp_profile_report(Scene *sc);
+size_t sp_arena_used(const Arena *a);
+size_t sp_arena_capacity(const Arena *a);
 void spc_reset(void);
 // Obj spo_rect(DVector2 pos, DVector2 size, Color color);
 bool spo_typst_compile(Typst *typ);
-void spo_get_pos(Obj *obj, DVector2 **pos);
-void spo_get_color(Obj *obj, Color **color);
-void spo_render(Obj obj);
+void spo_typst_upload(Typst *typ);
+int spo_kind_count(const ObjStore *store, ObjKind kind);
+void *spo_payload(const ObjStore *store, Id id);
+DVector2 *spo_pos(ObjState *state, const ObjStore *store, Id id);
+Color *spo_color(ObjState *state, const ObjStore *store, Id id);
+void spo_state_reserve(Arena *a, ObjState *state, int n);
+Rectangle spo_bounds(const ObjStore *store, const ObjState *state, Id id);
+bool spo_visible(const ObjStore *store, const ObjState *state, Id id);
+void spo_render(const ObjStore *store, const ObjState *state, Id id);
+void spr_batch_init(RectBatch *batch);
+void spr_batch_deinit(RectBatch *batch);
+void spr_batch_push(RectBatch *batch, DVector2 pos, DVector2 size, Color color);
+void spr_batch_flush(RectBatch *batch);
+void spg_build(SpatialGrid *grid);
+void spg_update(SpatialGrid *grid, Id id);
+void spg_query(SpatialGrid *grid, Rectangle view);
+Rectangle spg_view_rect(Camera2D cam, IVector2 size);
 Action spo_enable(Id obj_id);
-void spu_run_sequence(void);
-void spu_print_err(void);
-bool spu_call_fn(const char *fn_name, UmkaStackSlot **slot, size_t storage_bytes);
-bool spu_content_w_preamble(const char *filename, char **content);
+Action spo_disable(Id obj_id);
+bool spu_run_sequence(Scene *sc);
+void spu_print_err(Scene *sc);
+void spu_print_umka_err(void *umka, LineMap lines);
+bool spu_call_fn(Scene *sc, const char *fn_name, UmkaStackSlot **slot, size_t storage_bytes);
+bool spu_content_w_preamble(Scene *sc, const char *filename, char **content);
 void spuo_rect(UmkaStackSlot *p, UmkaStackSlot *r);
 void spuo_text(UmkaStackSlot *p, UmkaStackSlot *r);
 void spuo_axes(UmkaStackSlot *p, UmkaStackSlot *r);
 void spuo_curve(UmkaStackSlot *p, UmkaStackSlot *r);
 void spuo_typst(UmkaStackSlot *p, UmkaStackSlot *r);
 void spuo_enable(UmkaStackSlot *p, UmkaStackSlot *r);
+void spuo_remove(UmkaStackSlot *p, UmkaStackSlot *r);
+void spuo_rects(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_fade_in_many(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_move_many(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_add_updater(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_set_pos(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_set_color(UmkaStackSlot *p, UmkaStackSlot *r);
 void spu_fade_in(UmkaStackSlot *p, UmkaStackSlot *r);
 void spu_fade_out(UmkaStackSlot *p, UmkaStackSlot *r);
 void spu_move(UmkaStackSlot *p, UmkaStackSlot *r);
 void spu_wait(UmkaStackSlot *p, UmkaStackSlot *r);
 void spu_play(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_camera_move(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_camera_zoom(UmkaStackSlot *p, UmkaStackSlot *r);
+void spu_camera_rotate(UmkaStackSlot *p, UmkaStackSlot *r);
 void spa_interp(Action action, void **value, f32 factor);
 f32 sp_easing(f32 t, f32 duration);
 Vector2 spv_dtof(DVector2 dv);
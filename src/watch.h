@@ -0,0 +1,16 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <stdbool.h>
+
+typedef struct Watcher Watcher;
+
+Watcher *watch_start(const char **paths, int count);
+// NOTE: Starts watching one more file, for scripts that pick up imports
+bool watch_add(Watcher *watcher, const char *path);
+// NOTE: Returns true if any of the watched files has been written to, created
+// or replaced since the last call. It never blocks.
+bool watch_poll(Watcher *watcher);
+void watch_stop(Watcher *watcher);
+
+#endif // WATCH_H_
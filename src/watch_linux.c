@@ -0,0 +1,117 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <raylib.h>
+
+#include "watch.h"
+
+#define WATCH_MAX_FILES 64
+
+typedef struct {
+    int wd;
+    char dir[PATH_MAX];
+    char name[NAME_MAX + 1];
+} WatchedFile;
+
+struct Watcher {
+    int fd;
+    int count;
+    WatchedFile files[WATCH_MAX_FILES];
+};
+
+Watcher *watch_start(const char **paths, int count)
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        TraceLog(LOG_ERROR, "WATCH: could not initialize inotify: %s", strerror(errno));
+        return NULL;
+    }
+
+    Watcher *watcher = malloc(sizeof(Watcher));
+    assert(watcher != NULL && "Buy MORE RAM lol!!");
+    watcher->fd = fd;
+    watcher->count = 0;
+
+    for (int i = 0; i < count; i++) {
+        watch_add(watcher, paths[i]);
+    }
+
+    return watcher;
+}
+
+bool watch_add(Watcher *watcher, const char *path)
+{
+    if (watcher == NULL) return false;
+    if (watcher->count >= WATCH_MAX_FILES) {
+        TraceLog(LOG_WARNING, "WATCH: could not watch '%s': more than %d files", path, WATCH_MAX_FILES);
+        return false;
+    }
+
+    WatchedFile *f = &watcher->files[watcher->count];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(f->dir, sizeof(f->dir), ".");
+        snprintf(f->name, sizeof(f->name), "%s", path);
+    } else {
+        snprintf(f->dir, sizeof(f->dir), "%.*s", (int)(slash - path), path);
+        if (f->dir[0] == '\0') snprintf(f->dir, sizeof(f->dir), "/");
+        snprintf(f->name, sizeof(f->name), "%s", slash + 1);
+    }
+
+    // NOTE: Editors often save by writing a new file and renaming it over
+    // the old one, which would drop a watch on the file itself. Watching
+    // the directory survives that.
+    f->wd = inotify_add_watch(watcher->fd, f->dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+    if (f->wd < 0) {
+        TraceLog(LOG_WARNING, "WATCH: could not watch '%s': %s", f->dir, strerror(errno));
+        return false;
+    }
+    watcher->count++;
+    return true;
+}
+
+bool watch_poll(Watcher *watcher)
+{
+    bool changed = false;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(watcher->fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno != EAGAIN) {
+                TraceLog(LOG_WARNING, "WATCH: could not read inotify events: %s", strerror(errno));
+            }
+            break;
+        }
+
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            for (int i = 0; i < watcher->count && ev->len > 0; i++) {
+                const WatchedFile *f = &watcher->files[i];
+                if (f->wd == ev->wd && strcmp(f->name, ev->name) == 0) {
+                    changed = true;
+                }
+            }
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return changed;
+}
+
+void watch_stop(Watcher *watcher)
+{
+    if (watcher == NULL) return;
+
+    if (close(watcher->fd) < 0) {
+        TraceLog(LOG_WARNING, "WATCH: could not close inotify: %s", strerror(errno));
+    }
+    free(watcher);
+}